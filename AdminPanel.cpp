@@ -1,9 +1,94 @@
-#include "Database.h"
+#include <algorithm>
+#include <vector>
+
 #include "AdminPanel.h"
 #include "UserPanel.h"
 #include "Constants.h"
 #include "resource.h"
 
+namespace {
+    // Rows of the user list. The list box has no data of its own, rows are looked up when they are drawn
+    struct UserListView {
+        // Range of username order matching the search prefix
+        size_t first;
+        size_t count;
+        // Similar usernames when nothing starts with the search text
+        std::vector<UserId> similar;
+        bool isSimilar;
+        // Logged-in admin, left out of every view since they can't edit their own profile
+        UserId hidden;
+        // Row of the prefix range the hidden user is skipped at, count if the range doesn't have them
+        size_t hiddenRow;
+    };
+
+    UserListView* GetListView(HWND hwnd) {
+        return (UserListView*)GetWindowLongPtrW(hwnd, DWLP_USER);
+    }
+
+    UserId GetListUser(const Database& database, const UserListView& view, size_t row) {
+        if (view.isSimilar) {
+            return row < view.similar.size() ? view.similar[row] : kInvalidUser;
+        }
+
+        UserId id = kInvalidUser;
+        if (row < view.count) {
+            database.GetUsersInOrder(view.first + row + (row >= view.hiddenRow ? 1 : 0), 1, &id);
+        }
+
+        return id;
+    }
+
+    // Shows users starting with the search text, or the closest ones if there are none
+    void UpdateUserList(HWND hwnd, const Database& database) {
+        std::wstring search;
+        search.resize(GetWindowTextLengthW(GetDlgItem(hwnd, IDC_EDIT_SEARCH)));
+        GetDlgItemTextW(hwnd, IDC_EDIT_SEARCH, &search[0], (int)search.length() + 1);
+
+        UserListView& view = *GetListView(hwnd);
+        view.count = database.FindPrefix(search, view.first);
+        view.isSimilar = view.count == 0 && !search.empty();
+        view.similar.clear();
+        if (view.isSimilar) {
+            size_t total;
+            view.similar = database.FindSimilar(search, kSearchDistance, 0, kSearchResults + 1, total);
+            view.similar.erase(std::remove(view.similar.begin(), view.similar.end(), view.hidden), view.similar.end());
+            if (view.similar.size() > kSearchResults) {
+                view.similar.resize(kSearchResults);
+            }
+        }
+
+        // Exact username comes first among the names it prefixes
+        size_t hiddenPosition;
+        view.hiddenRow = view.count;
+        if (database.FindPrefix(database.GetUsername(view.hidden), hiddenPosition) != 0 && hiddenPosition - view.first < view.count) {
+            view.hiddenRow = hiddenPosition - view.first;
+            --view.count;
+        }
+
+        HWND hListBox = GetDlgItem(hwnd, IDC_LIST_USERS);
+        SendMessageW(hListBox, LB_SETCOUNT, view.isSimilar ? view.similar.size() : view.count, 0);
+        InvalidateRect(hListBox, nullptr, TRUE);
+    }
+
+    void DrawUserRow(const DRAWITEMSTRUCT& item, const Database& database, const UserListView& view) {
+        bool isSelected = (item.itemState & ODS_SELECTED) != 0;
+        FillRect(item.hDC, &item.rcItem, GetSysColorBrush(isSelected ? COLOR_HIGHLIGHT : COLOR_WINDOW));
+        UserId id = item.itemID == (UINT)-1 ? kInvalidUser : GetListUser(database, view, item.itemID);
+        if (id != kInvalidUser) {
+            std::wstring_view username = database.GetUsername(id);
+            RECT text = item.rcItem;
+            text.left += 2;
+            SetBkMode(item.hDC, TRANSPARENT);
+            SetTextColor(item.hDC, GetSysColor(isSelected ? COLOR_HIGHLIGHTTEXT : COLOR_WINDOWTEXT));
+            DrawTextW(item.hDC, username.data(), (int)username.length(), &text, DT_SINGLELINE | DT_VCENTER | DT_NOPREFIX | DT_END_ELLIPSIS);
+        }
+
+        if (item.itemState & ODS_FOCUS) {
+            DrawFocusRect(item.hDC, &item.rcItem);
+        }
+    }
+}
+
 LRESULT CALLBACK AddUserProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam) {
     switch (message) {
     case WM_INITDIALOG:
@@ -23,16 +108,14 @@ LRESULT CALLBACK AddUserProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lPar
             std::wstring username;
             username.resize(usernameLength);
             GetDlgItemTextW(hwnd, IDC_EDIT1, &username[0], usernameLength + 1);
-            Database* database = (Database*)GetWindowLongPtrW(hwnd, GWLP_USERDATA);
-            for (const std::unique_ptr<User>& user : database->users) {
-                if (user->username == username) {
-                    MessageBoxW(hwnd, L"User already exists!", L"Warning", MB_OK | MB_ICONERROR);
-                    return TRUE;
-                }
+            const UserPanelInput* input = (const UserPanelInput*)GetWindowLongPtrW(hwnd, GWLP_USERDATA);
+            UserId user;
+            AuthStatus status = input->auth.AddUser(input->session, username, user);
+            if (status != AuthStatus::OK) {
+                MessageBoxW(hwnd, input->auth.GetStatusMessage(status), L"Warning", MB_OK | MB_ICONERROR);
+                return TRUE;
             }
 
-            database->users.emplace_back(std::make_unique<User>(username.c_str(), L"", false, false));
-            database->Save();
             EndDialog(hwnd, true);
 
             break;
@@ -54,13 +137,14 @@ LRESULT CALLBACK UserProfileProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM
         HWND hUserName = GetDlgItem(hwnd, IDC_USER_USERNAME);
         HWND hBlocked = GetDlgItem(hwnd, IDC_CHECK_BLOCKED);
         HWND hRestrictions = GetDlgItem(hwnd, IDC_CHECK_RESTRICTION);
-        std::wstring text = L"User: " + ((const User*)lParam)->username;
+        const UserPanelInput* input = (const UserPanelInput*)lParam;
+        std::wstring text = std::wstring(L"User: ").append(input->database.GetUsername(input->user));
         SetWindowTextW(hUserName, text.c_str());
-        if (((const User*)lParam)->isBlocked) {
+        if (input->database.IsBlocked(input->user)) {
             SendMessageW(hBlocked, BM_SETCHECK, BST_CHECKED, 0);
         }
         
-        if (((const User*)lParam)->isRestrictionEnabled) {
+        if (input->database.IsRestrictionEnabled(input->user)) {
             SendMessageW(hRestrictions, BM_SETCHECK, BST_CHECKED, 0);
         }
 
@@ -72,14 +156,22 @@ LRESULT CALLBACK UserProfileProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM
     case WM_COMMAND:
         if (LOWORD(wParam) == IDC_CHECK_BLOCKED && HIWORD(wParam) == BN_CLICKED) {
             HWND hBlocked = GetDlgItem(hwnd, IDC_CHECK_BLOCKED);
-            ((User*)GetWindowLongPtrW(hwnd, GWLP_USERDATA))->isBlocked = SendMessageW(hBlocked, BM_GETCHECK, 0, 0) == BST_CHECKED;
+            const UserPanelInput* input = (const UserPanelInput*)GetWindowLongPtrW(hwnd, GWLP_USERDATA);
+            AuthStatus status = input->auth.SetBlocked(input->session, input->user, SendMessageW(hBlocked, BM_GETCHECK, 0, 0) == BST_CHECKED);
+            if (status != AuthStatus::OK) {
+                MessageBoxW(hwnd, input->auth.GetStatusMessage(status), L"Warning", MB_OK | MB_ICONERROR);
+            }
 
             break;
         }
 
         if (LOWORD(wParam) == IDC_CHECK_RESTRICTION && HIWORD(wParam) == BN_CLICKED) {
             HWND hRestrictions = GetDlgItem(hwnd, IDC_CHECK_RESTRICTION);
-            ((User*)GetWindowLongPtrW(hwnd, GWLP_USERDATA))->isRestrictionEnabled = SendMessageW(hRestrictions, BM_GETCHECK, 0, 0) == BST_CHECKED;
+            const UserPanelInput* input = (const UserPanelInput*)GetWindowLongPtrW(hwnd, GWLP_USERDATA);
+            AuthStatus status = input->auth.SetRestrictionEnabled(input->session, input->user, SendMessageW(hRestrictions, BM_GETCHECK, 0, 0) == BST_CHECKED);
+            if (status != AuthStatus::OK) {
+                MessageBoxW(hwnd, input->auth.GetStatusMessage(status), L"Warning", MB_OK | MB_ICONERROR);
+            }
 
             break;
         }
@@ -98,55 +190,66 @@ LRESULT CALLBACK AdminPanelProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM l
     {
         SetWindowLongPtrW(hwnd, GWLP_USERDATA, lParam);
         HWND hUserName = GetDlgItem(hwnd, IDC_USER_USERNAME);
-        std::wstring text = L"User: " + ((const UserPanelInput*)lParam)->user->username;
+        const UserPanelInput* input = (const UserPanelInput*)lParam;
+        std::wstring text = std::wstring(L"User: ").append(input->database.GetUsername(input->user));
         SetWindowTextW(hUserName, text.c_str());
 
-        HWND hListBox = GetDlgItem(hwnd, IDC_LIST_USERS);
-        for (const std::unique_ptr<User>& user : ((const UserPanelInput*)lParam)->database.users) {
-            if (user->username == ((const UserPanelInput*)lParam)->user->username) {
-                continue;
-            }
+        // Only visible rows are read from the database, so opening the panel doesn't depend on the user count
+        UserListView* view = new UserListView();
+        view->hidden = input->user;
+        SetWindowLongPtrW(hwnd, DWLP_USER, (LONG_PTR)view);
+        UpdateUserList(hwnd, input->database);
 
-            SendMessageW(hListBox, LB_ADDSTRING, 0, (LPARAM)user->username.c_str());
+        break;
+    }
+    case WM_DRAWITEM:
+    {
+        const DRAWITEMSTRUCT* item = (const DRAWITEMSTRUCT*)lParam;
+        if (item->CtlID != IDC_LIST_USERS) {
+            return FALSE;
         }
 
+        const UserPanelInput* input = (const UserPanelInput*)GetWindowLongPtrW(hwnd, GWLP_USERDATA);
+        DrawUserRow(*item, input->database, *GetListView(hwnd));
         break;
     }
     case WM_CLOSE:
         EndDialog(hwnd, 0);
         break;
+    case WM_DESTROY:
+        delete GetListView(hwnd);
+        SetWindowLongPtrW(hwnd, DWLP_USER, 0);
+        break;
     case WM_COMMAND:
         if (LOWORD(wParam) == ID_MENU_ABOUTPROGRAM) {
-            MessageBoxW(hwnd, kAboutMessage, L"About Program", MB_ICONINFORMATION | MB_OK);
+            const UserPanelInput* input = (const UserPanelInput*)GetWindowLongPtrW(hwnd, GWLP_USERDATA);
+            std::wstring about = std::wstring(kAboutMessage).append(DescribePasswordPolicy(input->auth.passwordPolicy));
+            MessageBoxW(hwnd, about.c_str(), L"About Program", MB_ICONINFORMATION | MB_OK);
             break;
         }
         else if (LOWORD(wParam) == ID_USER_CHANGEPASS && HIWORD(wParam) == BN_CLICKED) {
-            // Change password. Update database
+            // Change password. Database journals it
             const UserPanelInput* input = (const UserPanelInput*)GetWindowLongPtrW(hwnd, GWLP_USERDATA);
-            bool status = DialogBoxParamW(GetModuleHandleW(nullptr), MAKEINTRESOURCE(IDD_CHANGEPASSWORD), hwnd, ChangePasswordProc, (LPARAM)input->user);
-            if (status) {
-                input->database.Save();
-            }
+            DialogBoxParamW(GetModuleHandleW(nullptr), MAKEINTRESOURCE(IDD_CHANGEPASSWORD), hwnd, ChangePasswordProc, (LPARAM)input);
 
             break;
         }
         else if (LOWORD(wParam) == ID_ADDUSER && HIWORD(wParam) == BN_CLICKED) {
             const UserPanelInput* input = (const UserPanelInput*)GetWindowLongPtrW(hwnd, GWLP_USERDATA);
-            bool status = DialogBoxParamW(GetModuleHandleW(nullptr), MAKEINTRESOURCE(IDD_ADDUSER), hwnd, AddUserProc, (LPARAM)&input->database);
+            bool status = DialogBoxParamW(GetModuleHandleW(nullptr), MAKEINTRESOURCE(IDD_ADDUSER), hwnd, AddUserProc, (LPARAM)input);
             if (status) {
-                HWND hListBox = GetDlgItem(hwnd, IDC_LIST_USERS);
-                SendMessageW(hListBox, LB_RESETCONTENT, 0, 0);
-                for (const std::unique_ptr<User>& user : input->database.users) {
-                    if (user->username == input->user->username) {
-                        continue;
-                    }
-
-                    SendMessageW(hListBox, LB_ADDSTRING, 0, (LPARAM)user->username.c_str());
-                }
+                // Positions in username order shifted
+                UpdateUserList(hwnd, input->database);
             }
 
             break;
         }
+        else if (LOWORD(wParam) == IDC_EDIT_SEARCH && HIWORD(wParam) == EN_CHANGE) {
+            const UserPanelInput* input = (const UserPanelInput*)GetWindowLongPtrW(hwnd, GWLP_USERDATA);
+            UpdateUserList(hwnd, input->database);
+
+            break;
+        }
 
         else if (LOWORD(wParam) == IDC_LIST_USERS && HIWORD(wParam) == LBN_DBLCLK) {
             HWND hListBox = GetDlgItem(hwnd, IDC_LIST_USERS);
@@ -155,21 +258,14 @@ LRESULT CALLBACK AdminPanelProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM l
                 break;
             }
 
-            std::wstring selectedUsername;
-            selectedUsername.resize(SendMessageW(hListBox, LB_GETTEXTLEN, selectedIndex, 0));
-            SendMessageW(hListBox, LB_GETTEXT, selectedIndex, (LPARAM)&selectedUsername[0]);
-
-            const Database& database = ((UserPanelInput*)GetWindowLongPtrW(hwnd, GWLP_USERDATA))->database;
-            User* user = nullptr;
-            for (const std::unique_ptr<User>& curr : database.users) {
-                if (curr->username == selectedUsername) {
-                    user = curr.get();
-                    break;
-                }
+            const UserPanelInput* input = (const UserPanelInput*)GetWindowLongPtrW(hwnd, GWLP_USERDATA);
+            UserPanelInput profileInput = { input->auth, input->database, GetListUser(input->database, *GetListView(hwnd), selectedIndex), input->session };
+            // Admin can't block themselves
+            if (profileInput.user == kInvalidUser || profileInput.user == input->user) {
+                break;
             }
 
-            DialogBoxParamW(GetModuleHandleW(nullptr), MAKEINTRESOURCE(IDD_DIALOG_USER_PROFILE), nullptr, UserProfileProc, (LPARAM)user);
-            database.Save();
+            DialogBoxParamW(GetModuleHandleW(nullptr), MAKEINTRESOURCE(IDD_DIALOG_USER_PROFILE), nullptr, UserProfileProc, (LPARAM)&profileInput);
         }
 
         break;
@@ -0,0 +1,464 @@
+#include "AuthServer.h"
+
+#ifdef __linux__
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "Constants.h"
+#include "Encoding.h"
+
+namespace {
+    enum class SessionState {
+        ANONYMOUS,
+        PASSWORD_NOT_SET,
+        AUTHORIZED
+    };
+
+    const char* GetStatusName(AuthStatus status) {
+        switch (status) {
+        case AuthStatus::OK:
+            return "OK";
+        case AuthStatus::PASSWORD_NOT_SET:
+            return "PASSWORD_NOT_SET";
+        case AuthStatus::USER_NOT_FOUND:
+            return "USER_NOT_FOUND";
+        case AuthStatus::USER_EXISTS:
+            return "USER_EXISTS";
+        case AuthStatus::BLOCKED:
+            return "BLOCKED";
+        case AuthStatus::WRONG_HANDSHAKE:
+            return "WRONG_HANDSHAKE";
+        case AuthStatus::WRONG_PASSWORD:
+            return "WRONG_PASSWORD";
+        case AuthStatus::NO_ATTEMPTS_LEFT:
+            return "NO_ATTEMPTS_LEFT";
+        case AuthStatus::INVALID_PASSWORD:
+            return "INVALID_PASSWORD";
+        case AuthStatus::SAME_PASSWORD:
+            return "SAME_PASSWORD";
+        case AuthStatus::RATE_LIMITED:
+            return "RATE_LIMITED";
+        case AuthStatus::SESSION_EXPIRED:
+            return "SESSION_EXPIRED";
+        case AuthStatus::ACCESS_DENIED:
+            return "ACCESS_DENIED";
+        }
+
+        return "UNKNOWN";
+    }
+
+    void SplitFields(std::string_view line, std::vector<std::string_view>& fields) {
+        fields.clear();
+        size_t start = 0;
+        for (size_t i = 0; i <= line.length(); ++i) {
+            if (i == line.length() || line[i] == '\t') {
+                fields.push_back(line.substr(start, i - start));
+                start = i + 1;
+            }
+        }
+    }
+
+    bool SendAll(int fd, const char* data, size_t size) {
+        while (size != 0) {
+            ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+            if (sent > 0) {
+                data += sent;
+                size -= sent;
+                continue;
+            }
+
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+
+            // Slow reader. Wait a bit for the buffer to drain
+            pollfd pfd = { fd, POLLOUT, 0 };
+            if (sent < 0 && errno == EAGAIN && poll(&pfd, 1, 1000) > 0) {
+                continue;
+            }
+
+            return false;
+        }
+
+        return true;
+    }
+}
+
+struct AuthServer::Connection {
+    int fd;
+    std::string input;
+    // Token comes with every login, the server keeps no challenge state
+    LoginChallenge challenge = { {}, kAttempts, 0 };
+    bool isClosing = false;
+    SessionState state = SessionState::ANONYMOUS;
+    UserId user = kInvalidUser;
+    // Issued on authorization, so a block ends the connection's rights
+    SessionToken session = {};
+};
+
+AuthServer::AuthServer(AuthService& auth, size_t workerCount)
+    : auth(auth), workerCount(workerCount ? workerCount : std::max(1u, std::thread::hardware_concurrency()))
+    , running(false), listenFd(-1), epollFd(-1), wakeFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+
+AuthServer::~AuthServer() {
+    if (wakeFd != -1) {
+        close(wakeFd);
+    }
+}
+
+bool AuthServer::Run(const char* socketPath) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (wakeFd == -1 || strlen(socketPath) >= sizeof(address.sun_path)) {
+        return false;
+    }
+
+    strcpy(address.sun_path, socketPath);
+    unlink(socketPath);
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd == -1) {
+        return false;
+    }
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event listenEvent = { EPOLLIN, { .ptr = nullptr } };
+    epoll_event wakeEvent = { EPOLLIN, { .ptr = &wakeFd } };
+    if (bind(listenFd, (const sockaddr*)&address, sizeof(address)) != 0 || listen(listenFd, SOMAXCONN) != 0
+        || epollFd == -1
+        || epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &listenEvent) != 0
+        || epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &wakeEvent) != 0) {
+        close(listenFd);
+        if (epollFd != -1) {
+            close(epollFd);
+        }
+
+        listenFd = -1;
+        epollFd = -1;
+        return false;
+    }
+
+    // Ready connections are queued for workers. Connections are armed with EPOLLONESHOT,
+    // so only one worker owns a connection at a time and rearms it when done
+    std::mutex queueLock;
+    std::condition_variable queueReady;
+    std::deque<Connection*> queue;
+    std::unordered_set<Connection*> connections;
+    running = true;
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < workerCount; ++i) {
+        workers.emplace_back([&]() {
+            while (true) {
+                Connection* connection;
+                {
+                    std::unique_lock<std::mutex> guard(queueLock);
+                    queueReady.wait(guard, [&]() { return !queue.empty() || !running; });
+                    if (queue.empty()) {
+                        return;
+                    }
+
+                    connection = queue.front();
+                    queue.pop_front();
+                }
+
+                bool isOpen = Serve(connection);
+                {
+                    // Rearm under the lock: the next worker takes the connection through the same lock,
+                    // so it sees everything this one wrote. After that the connection isn't ours anymore
+                    std::lock_guard<std::mutex> guard(queueLock);
+                    epoll_event event = { EPOLLIN | EPOLLRDHUP | EPOLLONESHOT, { .ptr = connection } };
+                    if (isOpen && epoll_ctl(epollFd, EPOLL_CTL_MOD, connection->fd, &event) == 0) {
+                        continue;
+                    }
+
+                    connections.erase(connection);
+                }
+
+                Close(connection);
+            }
+        });
+    }
+
+    epoll_event events[64];
+    // Listening socket is disarmed until then after accept failed for lack of resources, so it doesn't spin the loop
+    bool isListenPaused = false;
+    std::chrono::steady_clock::time_point resumeListen;
+    while (running) {
+        int timeout = -1;
+        if (isListenPaused) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(resumeListen - std::chrono::steady_clock::now());
+            timeout = (int)std::max<int64_t>(0, left.count());
+        }
+
+        int count = epoll_wait(epollFd, events, 64, timeout);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            break;
+        }
+
+        if (isListenPaused && std::chrono::steady_clock::now() >= resumeListen) {
+            epoll_event event = { EPOLLIN, { .ptr = nullptr } };
+            epoll_ctl(epollFd, EPOLL_CTL_MOD, listenFd, &event);
+            isListenPaused = false;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            if (events[i].data.ptr == &wakeFd) {
+                running = false;
+                continue;
+            }
+
+            if (events[i].data.ptr == nullptr) {
+                while (true) {
+                    int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                    if (fd == -1) {
+                        if (errno == EINTR || errno == ECONNABORTED) {
+                            continue;
+                        }
+
+                        // EMFILE, ENFILE, ENOBUFS, ENOMEM: the pending connection stays queued and the level-triggered
+                        // socket would report it again at once. Stop watching it for a while instead
+                        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                            epoll_event event = { 0, { .ptr = nullptr } };
+                            epoll_ctl(epollFd, EPOLL_CTL_MOD, listenFd, &event);
+                            isListenPaused = true;
+                            resumeListen = std::chrono::steady_clock::now() + std::chrono::milliseconds(kAcceptRetryMs);
+                        }
+
+                        break;
+                    }
+
+                    Connection* connection = new Connection();
+                    connection->fd = fd;
+                    // Clients are told apart by their user id, 0 is reserved for local logins
+                    ucred credentials;
+                    socklen_t length = sizeof(credentials);
+                    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0) {
+                        connection->challenge.source = (uint64_t)credentials.uid + 1;
+                    }
+
+                    {
+                        std::lock_guard<std::mutex> guard(queueLock);
+                        connections.insert(connection);
+                    }
+
+                    epoll_event event = { EPOLLIN | EPOLLRDHUP | EPOLLONESHOT, { .ptr = connection } };
+                    epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+                }
+
+                continue;
+            }
+
+            {
+                std::lock_guard<std::mutex> guard(queueLock);
+                queue.push_back((Connection*)events[i].data.ptr);
+            }
+
+            queueReady.notify_one();
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(queueLock);
+        running = false;
+        queue.clear();
+    }
+
+    queueReady.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    for (Connection* connection : connections) {
+        Close(connection);
+    }
+
+    close(epollFd);
+    close(listenFd);
+    unlink(socketPath);
+    epollFd = -1;
+    listenFd = -1;
+    return true;
+}
+
+void AuthServer::Stop() {
+    uint64_t value = 1;
+    ssize_t result = write(wakeFd, &value, sizeof(value));
+    (void)result;
+}
+
+bool AuthServer::Serve(Connection* connection) {
+    char buffer[4096];
+    bool isEof = false;
+    // Reading stops once a request could be over the limit. The rest stays in the socket, the rearmed connection
+    // comes back for it, so a client sending without newlines can't grow the input or hold the worker
+    while (connection->input.length() <= kMaxRequestLength) {
+        ssize_t received = recv(connection->fd, buffer, sizeof(buffer), 0);
+        if (received > 0) {
+            connection->input.append(buffer, received);
+            continue;
+        }
+
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+
+        isEof = received == 0 || errno != EAGAIN;
+        break;
+    }
+
+    // Answer every complete line
+    std::string output;
+    std::string response;
+    size_t start = 0;
+    size_t end;
+    while (!connection->isClosing && (end = connection->input.find('\n', start)) != std::string::npos) {
+        std::string_view request(connection->input.data() + start, end - start);
+        if (!request.empty() && request.back() == '\r') {
+            request.remove_suffix(1);
+        }
+
+        if (!Handle(*connection, request, response)) {
+            connection->isClosing = true;
+        }
+
+        output.append(response).push_back('\n');
+        start = end + 1;
+    }
+
+    connection->input.erase(0, start);
+    if (connection->input.length() > kMaxRequestLength) {
+        output.append("ERR\tREQUEST_TOO_LONG\n");
+        connection->isClosing = true;
+    }
+
+    if (!SendAll(connection->fd, output.data(), output.length()) || isEof) {
+        connection->isClosing = true;
+    }
+
+    return !connection->isClosing;
+}
+
+bool AuthServer::Handle(Connection& connection, std::string_view request, std::string& response) {
+    thread_local std::vector<std::string_view> fields;
+    thread_local std::wstring arguments[4];
+
+    SplitFields(request, fields);
+    for (size_t i = 1; i < fields.size() && i <= 4; ++i) {
+        if (!ReadUtf8(fields[i].data(), fields[i].length(), arguments[i - 1])) {
+            response = "ERR\tBAD_REQUEST";
+            return true;
+        }
+    }
+
+    std::string_view command = fields[0];
+    AuthStatus status;
+    if (command == "HANDSHAKE" && fields.size() == 1) {
+        ChallengeToken token = auth.challenges.Issue();
+        response = "OK\t" + std::to_string(token.input) + "\t" + EncodeToken(token);
+        return true;
+    }
+    else if (command == "LOGIN" && fields.size() == 5) {
+        // New login replaces whatever the connection was authorized as
+        auth.sessions.Revoke(connection.session);
+        connection.session = {};
+        if (!DecodeToken(fields[3], connection.challenge.token)) {
+            status = AuthStatus::WRONG_HANDSHAKE;
+        }
+        else {
+            status = auth.Login(connection.challenge, arguments[0], arguments[1], arguments[3], connection.user);
+        }
+
+        if (status == AuthStatus::OK) {
+            connection.state = SessionState::AUTHORIZED;
+            connection.session = auth.sessions.Issue(connection.user);
+        }
+        else if (status == AuthStatus::PASSWORD_NOT_SET) {
+            connection.state = SessionState::PASSWORD_NOT_SET;
+            response = "PASSWORD_NOT_SET";
+            return true;
+        }
+        else {
+            connection.state = SessionState::ANONYMOUS;
+        }
+    }
+    else if (command == "SET_PASSWORD" && fields.size() == 2 && connection.state == SessionState::PASSWORD_NOT_SET) {
+        status = auth.SetInitialPassword(connection.user, arguments[0]);
+        if (status == AuthStatus::OK) {
+            connection.state = SessionState::AUTHORIZED;
+            connection.session = auth.sessions.Issue(connection.user);
+        }
+    }
+    else if (command == "CHANGE_PASSWORD" && fields.size() == 3 && connection.state == SessionState::AUTHORIZED) {
+        status = auth.ChangePassword(connection.session, arguments[0], arguments[1]);
+        if (status == AuthStatus::SESSION_EXPIRED) {
+            connection.state = SessionState::ANONYMOUS;
+        }
+    }
+    else {
+        response = "ERR\tBAD_REQUEST";
+        return true;
+    }
+
+    if (status == AuthStatus::OK) {
+        response = "OK";
+    }
+    else {
+        response = std::string("ERR\t") + GetStatusName(status);
+    }
+
+    // Out of attempts. Drop the client like the login form does
+    return status != AuthStatus::NO_ATTEMPTS_LEFT;
+}
+
+void AuthServer::Close(Connection* connection) {
+    auth.sessions.Revoke(connection->session);
+    close(connection->fd);
+    delete connection;
+}
+
+#else
+
+struct AuthServer::Connection {};
+
+AuthServer::AuthServer(AuthService& auth, size_t workerCount)
+    : auth(auth), workerCount(workerCount), running(false), listenFd(-1), epollFd(-1), wakeFd(-1) {}
+
+AuthServer::~AuthServer() {}
+
+bool AuthServer::Run(const char* socketPath) {
+    return false;
+}
+
+void AuthServer::Stop() {}
+
+bool AuthServer::Serve(Connection* connection) {
+    return false;
+}
+
+bool AuthServer::Handle(Connection& connection, std::string_view request, std::string& response) {
+    return false;
+}
+
+void AuthServer::Close(Connection* connection) {}
+
+#endif
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+
+#include "AuthService.h"
+
+constexpr size_t kMaxRequestLength = 4096;
+// Listening pauses this long when accept runs out of descriptors or memory
+constexpr int kAcceptRetryMs = 100;
+
+// Serves AuthService over a Unix domain socket. One request per line, UTF-8, fields separated by tabs:
+//   HANDSHAKE                                   -> OK <input> <token>
+//   LOGIN <username> <password> <token> <response> -> OK | PASSWORD_NOT_SET | ERR <status>
+//   SET_PASSWORD <password>                     -> OK | ERR <status>   (after PASSWORD_NOT_SET)
+//   CHANGE_PASSWORD <password> <newPassword>    -> OK | ERR <status>   (after OK)
+// Authorized connection holds a session. Once the user is blocked its requests get ERR SESSION_EXPIRED
+// Epoll event loop hands ready connections to a worker pool. Linux only
+struct AuthServer {
+    AuthServer(AuthService& auth, size_t workerCount = 0);
+    ~AuthServer();
+    AuthServer(const AuthServer&) = delete;
+    AuthServer& operator=(const AuthServer&) = delete;
+
+    // Blocks until Stop(). Returns false if socket couldn't be set up
+    bool Run(const char* socketPath);
+    // Safe to call from another thread or a signal handler
+    void Stop();
+
+    AuthService& auth;
+    size_t workerCount;
+
+private:
+    struct Connection;
+
+    // Reads and answers pending requests. Returns false if connection has to be closed
+    bool Serve(Connection* connection);
+    bool Handle(Connection& connection, std::string_view request, std::string& response);
+    void Close(Connection* connection);
+
+    std::atomic<bool> running;
+    int listenFd;
+    int epollFd;
+    int wakeFd;
+};
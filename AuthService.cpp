@@ -0,0 +1,246 @@
+#include "AuthService.h"
+#include "Constants.h"
+#include "Metrics.h"
+
+AuthService::AuthService(UserStore& database, RateLimiter* limiter, const PasswordPolicy& passwordPolicy)
+    : database(database), limiter(limiter), passwordPolicy(passwordPolicy), invalidPasswordMessage(DescribePasswordPolicy(passwordPolicy) + L"!") {}
+
+AuthStatus AuthService::Login(LoginChallenge& challenge, std::wstring_view username, std::wstring_view password, std::wstring_view response, UserId& user) {
+    METRICS_TIME(Timer::LOGIN);
+    AuthStatus status = CheckLogin(challenge, username, password, response, user);
+    switch (status) {
+    case AuthStatus::OK:
+        METRICS_COUNT(Counter::LOGIN_OK);
+        break;
+    case AuthStatus::PASSWORD_NOT_SET:
+        METRICS_COUNT(Counter::LOGIN_PASSWORD_NOT_SET);
+        break;
+    case AuthStatus::USER_NOT_FOUND:
+        METRICS_COUNT(Counter::LOGIN_USER_NOT_FOUND);
+        break;
+    case AuthStatus::BLOCKED:
+        METRICS_COUNT(Counter::LOGIN_BLOCKED);
+        break;
+    case AuthStatus::WRONG_HANDSHAKE:
+        METRICS_COUNT(Counter::LOGIN_WRONG_HANDSHAKE);
+        break;
+    case AuthStatus::WRONG_PASSWORD:
+        METRICS_COUNT(Counter::LOGIN_WRONG_PASSWORD);
+        break;
+    case AuthStatus::NO_ATTEMPTS_LEFT:
+        METRICS_COUNT(Counter::LOGIN_NO_ATTEMPTS_LEFT);
+        break;
+    case AuthStatus::INVALID_PASSWORD:
+        METRICS_COUNT(Counter::LOGIN_INVALID_PASSWORD);
+        break;
+    case AuthStatus::RATE_LIMITED:
+        METRICS_COUNT(Counter::LOGIN_RATE_LIMITED);
+        break;
+    default:
+        break;
+    }
+
+    return status;
+}
+
+AuthStatus AuthService::CheckLogin(LoginChallenge& challenge, std::wstring_view username, std::wstring_view password, std::wstring_view response, UserId& user) {
+    // Throttled clients are rejected before any lookup or hashing
+    if (limiter != nullptr && challenge.source != 0 && !limiter->TryAcquireSource(challenge.source)) {
+        user = kInvalidUser;
+        return AuthStatus::RATE_LIMITED;
+    }
+
+    user = database.Find(username);
+    if (user == kInvalidUser) {
+        return AuthStatus::USER_NOT_FOUND;
+    }
+
+    if (database.IsBlocked(user)) {
+        return AuthStatus::BLOCKED;
+    }
+
+    int64_t output;
+    if (!ParseResponse(response, output) || !challenges.Verify(challenge.token, output)) {
+        return AuthStatus::WRONG_HANDSHAKE;
+    }
+
+    // User wasn't registered
+    if (!database.HasPassword(user)) {
+        if (database.IsRestrictionEnabled(user) && !passwordPolicy.IsValid(password)) {
+            return AuthStatus::INVALID_PASSWORD;
+        }
+
+        if (limiter != nullptr && challenge.source != 0) {
+            limiter->RefundSource(challenge.source);
+        }
+
+        return AuthStatus::PASSWORD_NOT_SET;
+    }
+
+    if (limiter != nullptr && !limiter->TryAcquireUser(username)) {
+        return AuthStatus::RATE_LIMITED;
+    }
+
+    if (!database.VerifyPassword(user, password)) {
+        --challenge.attempts;
+        return challenge.attempts <= 0 ? AuthStatus::NO_ATTEMPTS_LEFT : AuthStatus::WRONG_PASSWORD;
+    }
+
+    if (limiter != nullptr) {
+        limiter->RefundUser(username);
+        if (challenge.source != 0) {
+            limiter->RefundSource(challenge.source);
+        }
+    }
+
+    return AuthStatus::OK;
+}
+
+AuthStatus AuthService::SetInitialPassword(UserId user, std::wstring_view password) {
+    if (database.HasPassword(user)) {
+        return AuthStatus::WRONG_PASSWORD;
+    }
+
+    if (database.IsRestrictionEnabled(user) && !passwordPolicy.IsValid(password)) {
+        return AuthStatus::INVALID_PASSWORD;
+    }
+
+    // Two clients may race past the check above, only one of them sets the password
+    if (!database.SetInitialPassword(user, password)) {
+        return AuthStatus::WRONG_PASSWORD;
+    }
+
+    // Credentials must survive a crash once the user is told they changed
+    database.Flush();
+    return AuthStatus::OK;
+}
+
+AuthStatus AuthService::ChangePassword(UserId user, std::wstring_view password, std::wstring_view newPassword) {
+    if (!database.VerifyPassword(user, password)) {
+        return AuthStatus::WRONG_PASSWORD;
+    }
+
+    if (password == newPassword) {
+        return AuthStatus::SAME_PASSWORD;
+    }
+
+    if (database.IsRestrictionEnabled(user) && !passwordPolicy.IsValid(newPassword)) {
+        return AuthStatus::INVALID_PASSWORD;
+    }
+
+    database.SetPassword(user, newPassword);
+    database.Flush();
+    return AuthStatus::OK;
+}
+
+AuthStatus AuthService::ChangePassword(const SessionToken& session, std::wstring_view password, std::wstring_view newPassword) {
+    UserId user;
+    AuthStatus status = CheckSession(session, user);
+    if (status != AuthStatus::OK) {
+        return status;
+    }
+
+    return ChangePassword(user, password, newPassword);
+}
+
+AuthStatus AuthService::CheckSession(const SessionToken& session, UserId& user) {
+    if (!sessions.Validate(session, user)) {
+        return AuthStatus::SESSION_EXPIRED;
+    }
+
+    // Bulk blocking in the database doesn't go through SetBlocked, so its users are caught here
+    if (database.IsBlocked(user)) {
+        sessions.Revoke(session);
+        return AuthStatus::SESSION_EXPIRED;
+    }
+
+    return AuthStatus::OK;
+}
+
+AuthStatus AuthService::AddUser(const SessionToken& session, std::wstring_view username, UserId& user) {
+    AuthStatus status = CheckAdmin(session);
+    if (status != AuthStatus::OK) {
+        return status;
+    }
+
+    user = database.AddUser(User(username, L"", false, false));
+    if (user == kInvalidUser) {
+        return AuthStatus::USER_EXISTS;
+    }
+
+    database.Flush();
+    return AuthStatus::OK;
+}
+
+AuthStatus AuthService::SetBlocked(const SessionToken& session, UserId user, bool isBlocked) {
+    AuthStatus status = CheckAdmin(session);
+    if (status != AuthStatus::OK) {
+        return status;
+    }
+
+    database.SetBlocked(user, isBlocked);
+    // Sessions opened before the block stop working at once
+    if (isBlocked) {
+        sessions.RevokeUser(user);
+    }
+
+    database.Flush();
+    return AuthStatus::OK;
+}
+
+AuthStatus AuthService::SetRestrictionEnabled(const SessionToken& session, UserId user, bool isRestrictionEnabled) {
+    AuthStatus status = CheckAdmin(session);
+    if (status != AuthStatus::OK) {
+        return status;
+    }
+
+    database.SetRestrictionEnabled(user, isRestrictionEnabled);
+    database.Flush();
+    return AuthStatus::OK;
+}
+
+AuthStatus AuthService::CheckAdmin(const SessionToken& session) {
+    UserId user;
+    AuthStatus status = CheckSession(session, user);
+    if (status != AuthStatus::OK) {
+        return status;
+    }
+
+    return database.GetUsername(user) == kAdminUsername ? AuthStatus::OK : AuthStatus::ACCESS_DENIED;
+}
+
+const wchar_t* AuthService::GetStatusMessage(AuthStatus status) const {
+    return status == AuthStatus::INVALID_PASSWORD ? invalidPasswordMessage.c_str() : ::GetStatusMessage(status);
+}
+
+const wchar_t* GetStatusMessage(AuthStatus status) {
+    switch (status) {
+    case AuthStatus::OK:
+        return L"Success";
+    case AuthStatus::PASSWORD_NOT_SET:
+        return L"Password isn't set!";
+    case AuthStatus::USER_NOT_FOUND:
+        return L"User with such name doesn't exist!";
+    case AuthStatus::USER_EXISTS:
+        return L"User already exists!";
+    case AuthStatus::BLOCKED:
+        return L"Account is blocked!";
+    case AuthStatus::WRONG_HANDSHAKE:
+        return L"Wrong handshake!";
+    case AuthStatus::WRONG_PASSWORD:
+    case AuthStatus::NO_ATTEMPTS_LEFT:
+        return L"Wrong password!";
+    case AuthStatus::INVALID_PASSWORD:
+        return L"Password doesn't satisfy the password policy!";
+    case AuthStatus::SAME_PASSWORD:
+        return L"Passwords shouldn't be the same!";
+    case AuthStatus::RATE_LIMITED:
+        return L"Too many attempts. Try again later!";
+    case AuthStatus::SESSION_EXPIRED:
+        return L"Session has expired. Log in again!";
+    case AuthStatus::ACCESS_DENIED:
+        return L"Access denied!";
+    }
+
+    return L"Unknown error!";
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "UserStore.h"
+#include "RateLimiter.h"
+#include "ChallengeService.h"
+#include "PasswordPolicy.h"
+#include "SessionService.h"
+
+enum class AuthStatus {
+    OK,
+    PASSWORD_NOT_SET, // Credentials are fine, user has to choose a password with SetInitialPassword
+    USER_NOT_FOUND,
+    USER_EXISTS,
+    BLOCKED,
+    WRONG_HANDSHAKE,
+    WRONG_PASSWORD,
+    NO_ATTEMPTS_LEFT,
+    INVALID_PASSWORD, // Doesn't satisfy the password policy of a restricted user
+    SAME_PASSWORD,
+    RATE_LIMITED, // Too many attempts for this user or client
+    SESSION_EXPIRED, // Session is unknown, expired or revoked. User has to log in again
+    ACCESS_DENIED // Action needs the admin session
+};
+
+// State of one login form
+struct LoginChallenge {
+    ChallengeToken token;
+    int attempts;
+    // Client identity for rate limiting, 0 - local user
+    uint64_t source;
+};
+
+// Authentication rules without any UI. Dialogs and tools call it and only present the status
+struct AuthService {
+    // Logins aren't throttled without a limiter. Policy applies to users with restrictions enabled and must outlive the service
+    AuthService(UserStore& database, RateLimiter* limiter = nullptr, const PasswordPolicy& passwordPolicy = kDefaultPasswordPolicy);
+
+    // Checks user, handshake and password. Wrong password takes an attempt from challenge
+    AuthStatus Login(LoginChallenge& challenge, std::wstring_view username, std::wstring_view password, std::wstring_view response, UserId& user);
+    AuthStatus SetInitialPassword(UserId user, std::wstring_view password);
+    AuthStatus ChangePassword(UserId user, std::wstring_view password, std::wstring_view newPassword);
+    // Same checks for the user of a live session. Current password is still required, a session left open isn't enough.
+    // This is the only session action that runs the KDF, the admin actions below check the session alone
+    AuthStatus ChangePassword(const SessionToken& session, std::wstring_view password, std::wstring_view newPassword);
+    // Gets the user of a live session. Session of a blocked user is revoked, however the user was blocked
+    AuthStatus CheckSession(const SessionToken& session, UserId& user);
+    // Admin actions, session must belong to the admin. Blocking revokes every session of the user.
+    // Changes are on disk when they return
+    AuthStatus AddUser(const SessionToken& session, std::wstring_view username, UserId& user);
+    AuthStatus SetBlocked(const SessionToken& session, UserId user, bool isBlocked);
+    AuthStatus SetRestrictionEnabled(const SessionToken& session, UserId user, bool isRestrictionEnabled);
+    // Text for message boxes. INVALID_PASSWORD describes passwordPolicy
+    const wchar_t* GetStatusMessage(AuthStatus status) const;
+
+    UserStore& database;
+    RateLimiter* limiter;
+    const PasswordPolicy& passwordPolicy;
+    ChallengeService challenges;
+    // Issued by the caller after a successful login
+    SessionService sessions;
+
+private:
+    // Built once, so showing it doesn't allocate
+    std::wstring invalidPasswordMessage;
+    // OK only for a live admin session
+    AuthStatus CheckAdmin(const SessionToken& session);
+    // Login without metrics
+    AuthStatus CheckLogin(LoginChallenge& challenge, std::wstring_view username, std::wstring_view password, std::wstring_view response, UserId& user);
+};
+
+// Text for message boxes without a service at hand. INVALID_PASSWORD doesn't name the policy
+const wchar_t* GetStatusMessage(AuthStatus status);
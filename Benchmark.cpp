@@ -0,0 +1,776 @@
+// Benchmark suite for the Database, User serialization and validation hot paths. Built by CMakeLists.txt only.
+// Flags follow Google Benchmark: --benchmark_filter=<regex> --benchmark_min_time=<seconds> --benchmark_format=<console|json>
+// --benchmark_out=<file>, plus --max_users=<count> to cap dataset sizes. JSON has the Google Benchmark layout,
+// so its compare.py can diff two releases. Exits with 1 if a benchmark that must not allocate does
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <new>
+#include <random>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#include "Database.h"
+#include "AuthService.h"
+#include "Constants.h"
+#include "FileUtils.h"
+#include "PasswordHasher.h"
+#include "PasswordPolicy.h"
+#include "SessionService.h"
+#include "User.h"
+
+namespace {
+    // Heap allocations of the whole process, counted by the operator new below
+    std::atomic<uint64_t> allocations = 0;
+}
+
+namespace {
+    void* Allocate(size_t size, size_t alignment) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        size = size == 0 ? 1 : size;
+#ifdef _WIN32
+        void* memory = _aligned_malloc(size, alignment);
+#else
+        // aligned_alloc wants a multiple of the alignment
+        void* memory = alignment <= alignof(std::max_align_t) ? malloc(size) : aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+#endif
+        if (memory == nullptr) {
+            throw std::bad_alloc();
+        }
+
+        return memory;
+    }
+
+    void Release(void* memory) {
+#ifdef _WIN32
+        _aligned_free(memory);
+#else
+        free(memory);
+#endif
+    }
+}
+
+// Every replaceable form, so arrays and over-aligned types are counted and freed by the same pair
+void* operator new(size_t size) {
+    return Allocate(size, alignof(std::max_align_t));
+}
+
+void* operator new[](size_t size) {
+    return Allocate(size, alignof(std::max_align_t));
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    return Allocate(size, (size_t)alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return Allocate(size, (size_t)alignment);
+}
+
+void operator delete(void* memory) noexcept {
+    Release(memory);
+}
+
+void operator delete[](void* memory) noexcept {
+    Release(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    Release(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept {
+    Release(memory);
+}
+
+void operator delete(void* memory, std::align_val_t) noexcept {
+    Release(memory);
+}
+
+void operator delete[](void* memory, std::align_val_t) noexcept {
+    Release(memory);
+}
+
+void operator delete(void* memory, size_t, std::align_val_t) noexcept {
+    Release(memory);
+}
+
+void operator delete[](void* memory, size_t, std::align_val_t) noexcept {
+    Release(memory);
+}
+
+namespace {
+    constexpr size_t kDatasetSizes[] = { 1000, 10000, 100000, 1000000, 10000000 };
+    // Users are added to generated databases in batches of this size to bound memory
+    constexpr size_t kGenerateBatch = 1000000;
+    // Serialization benchmarks use one dataset
+    constexpr size_t kStreamUsers = 10000;
+    constexpr size_t kLookupNames = 4096;
+    // Commit benchmarks mutate a small dataset, so snapshots stay cheap next to a sync
+    constexpr size_t kCommitUsers = 1000;
+    constexpr size_t kCommitThreads = 8;
+    // Attempts per VerifyBatch call, enough to keep every core busy
+    constexpr size_t kVerifyBatchSize = 16;
+
+    // Keeps value alive without the compiler seeing through it
+    template<typename T>
+    void DoNotOptimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+        asm volatile("" : : "r,m"(value) : "memory");
+#else
+        static volatile const void* sink;
+        sink = &value;
+#endif
+    }
+
+    double CpuSeconds() {
+        return (double)std::clock() / CLOCKS_PER_SEC;
+    }
+
+    // Loop state of one run. Timing starts when the range-for starts and stops when it ends
+    struct State {
+        struct Iterator {
+            bool operator!=(const Iterator&) {
+                if (remaining == 0) {
+                    state->StopTiming();
+                    return false;
+                }
+
+                return true;
+            }
+
+            void operator++() {
+                --remaining;
+            }
+
+            int operator*() const {
+                return 0;
+            }
+
+            State* state;
+            size_t remaining;
+        };
+
+        Iterator begin() {
+            ResumeTiming();
+            return { this, iterations };
+        }
+
+        Iterator end() {
+            return { this, 0 };
+        }
+
+        // Setup inside the loop that shouldn't count
+        void PauseTiming() {
+            StopTiming();
+        }
+
+        void ResumeTiming() {
+            allocationStart = allocations.load(std::memory_order_relaxed);
+            realStart = std::chrono::steady_clock::now();
+            cpuStart = CpuSeconds();
+        }
+
+        void StopTiming() {
+            realSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - realStart).count();
+            cpuSeconds += CpuSeconds() - cpuStart;
+            allocationCount += allocations.load(std::memory_order_relaxed) - allocationStart;
+        }
+
+        size_t iterations;
+        // Items per iteration, reported as items_per_second
+        size_t items;
+        double realSeconds;
+        double cpuSeconds;
+        std::chrono::steady_clock::time_point realStart;
+        double cpuStart;
+        // Heap allocations inside the timed loop
+        uint64_t allocationCount;
+        uint64_t allocationStart;
+    };
+
+    struct Benchmark {
+        std::string name;
+        std::function<void(State&)> run;
+        // Timed loop must not touch the heap. Setup before the loop is the warm-up
+        bool isAllocationFree = false;
+    };
+
+    struct Result {
+        std::string name;
+        size_t iterations;
+        double realNs;
+        double cpuNs;
+        double itemsPerSecond;
+        double allocationsPerIteration;
+    };
+
+    // Random latin and cyrillic letters, unique by an index suffix
+    std::wstring MakeUsername(std::mt19937_64& random, size_t index) {
+        std::wstring username;
+        size_t length = 4 + random() % 8;
+        for (size_t i = 0; i < length; ++i) {
+            uint64_t letter = random() % 58;
+            username.push_back(letter < 26 ? (wchar_t)(L'a' + letter) : (wchar_t)(0x0430 + (letter - 26)));
+        }
+
+        return username.append(std::to_wstring(index));
+    }
+
+    // Users with ready hashes, so adding them doesn't run the KDF. Seeded, so every run sees the same data
+    std::vector<User> GenerateUsers(size_t first, size_t count) {
+        static const PasswordHash kHash = HashPassword(L"Passw0rd", kDefaultKdf, kMinKdfIterations);
+        std::mt19937_64 random(first);
+        std::vector<User> users;
+        users.reserve(count);
+        for (size_t i = first; i < first + count; ++i) {
+            User user;
+            user.username = MakeUsername(random, i);
+            // Some users haven't set a password yet
+            if (random() % 20 != 0) {
+                user.passwordHash = kHash;
+                memcpy(user.passwordHash.salt, &i, sizeof(i));
+            }
+
+            user.isBlocked = random() % 100 == 0;
+            user.isRestrictionEnabled = random() % 10 == 0;
+            users.push_back(std::move(user));
+        }
+
+        return users;
+    }
+
+    std::wstring DatasetFilename(size_t users, const char* kind) {
+        std::filesystem::path directory = std::filesystem::temp_directory_path() / "pr2_bench";
+        std::filesystem::create_directories(directory);
+        return (directory / (std::string(kind) + "_" + std::to_string(users) + ".dat")).wstring();
+    }
+
+    // Writes a snapshot of count users plus the admin, so opening it never writes
+    void GenerateDatabase(const std::wstring& filename, size_t count) {
+        std::filesystem::remove(filename);
+        std::filesystem::remove(filename + L".log");
+        Database database(filename.c_str());
+        for (size_t first = 0; first < count; first += kGenerateBatch) {
+            database.AddUsers(GenerateUsers(first, std::min(kGenerateBatch, count - first)));
+        }
+
+        database.Save();
+    }
+
+    // Dataset is generated once per size and reused by later runs
+    std::wstring Dataset(size_t users) {
+        static std::vector<std::pair<size_t, std::wstring>> datasets;
+        for (const auto& dataset : datasets) {
+            if (dataset.first == users) {
+                return dataset.second;
+            }
+        }
+
+        std::wstring filename = DatasetFilename(users, "load");
+        fprintf(stderr, "Generating %zu users...\n", users);
+        GenerateDatabase(filename, users);
+        datasets.emplace_back(users, filename);
+        return filename;
+    }
+
+    // Reads and decodes the snapshot, threadCount 1 shows what the parallel decode buys
+    void BenchLoad(State& state, size_t users, size_t threadCount) {
+        std::wstring filename = Dataset(users);
+        std::wstring scratch = DatasetFilename(users, "scratch");
+        std::filesystem::remove(scratch);
+        std::filesystem::remove(scratch + L".log");
+        Database database(scratch.c_str(), false);
+        std::vector<char> buffer;
+        for ([[maybe_unused]] auto _ : state) {
+            FileReadAll(filename.c_str(), buffer);
+            database.Load(buffer.data(), buffer.data() + buffer.size(), threadCount);
+            DoNotOptimize(database.UserCount());
+        }
+
+        state.items = users;
+    }
+
+    void BenchSave(State& state, size_t users) {
+        std::wstring filename = DatasetFilename(users, "save");
+        std::filesystem::copy_file(Dataset(users), filename, std::filesystem::copy_options::overwrite_existing);
+        std::filesystem::remove(filename + L".log");
+        Database database(filename.c_str());
+        bool isBlocked = false;
+        for ([[maybe_unused]] auto _ : state) {
+            // One changed user makes the database dirty, Save rewrites the whole snapshot
+            state.PauseTiming();
+            isBlocked = !isBlocked;
+            database.SetBlocked((UserId)(database.UserCount() - 1), isBlocked);
+            state.ResumeTiming();
+            database.Save();
+        }
+
+        state.items = users;
+    }
+
+    // Fresh copy of the kCommitUsers dataset. Mutations toggle blocking of every user in turn
+    std::wstring CommitDataset(const char* kind) {
+        std::wstring filename = DatasetFilename(kCommitUsers, kind);
+        std::filesystem::copy_file(Dataset(kCommitUsers), filename, std::filesystem::copy_options::overwrite_existing);
+        std::filesystem::remove(filename + L".log");
+        return filename;
+    }
+
+    // Every mutation is made durable by rewriting the snapshot
+    void BenchCommitSave(State& state) {
+        std::wstring filename = CommitDataset("commit_save");
+        Database database(filename.c_str());
+        size_t next = 0;
+        for ([[maybe_unused]] auto _ : state) {
+            UserId id = (UserId)(next++ % database.UserCount());
+            database.SetBlocked(id, !database.IsBlocked(id));
+            database.Save();
+        }
+
+        state.items = 1;
+    }
+
+    // Commits of threads mutating at once, each acknowledged only once durable. latencyUs 0 syncs the journal per mutation
+    void BenchCommitJournal(State& state, uint32_t latencyUs, size_t threads) {
+        std::wstring filename = CommitDataset("commit_journal");
+        Database database(filename.c_str());
+        database.SetCommitWindow(latencyUs, kCommitBatchBytes);
+        size_t perThread = (state.iterations + threads - 1) / threads;
+        for ([[maybe_unused]] auto _ : state) {
+            // Whole run happens in the first iteration, the rest only count
+            if (perThread == 0) {
+                continue;
+            }
+
+            std::vector<std::thread> workers;
+            for (size_t thread = 0; thread < threads; ++thread) {
+                workers.emplace_back([&database, thread, threads, perThread]() {
+                    for (size_t i = 0; i < perThread; ++i) {
+                        UserId id = (UserId)((i * threads + thread) % database.UserCount());
+                        database.SetBlocked(id, !database.IsBlocked(id));
+                        database.Flush();
+                    }
+                });
+            }
+
+            for (std::thread& worker : workers) {
+                worker.join();
+            }
+
+            perThread = 0;
+        }
+
+        state.items = 1;
+    }
+
+    void BenchFind(State& state, size_t users) {
+        std::wstring filename = Dataset(users);
+        Database database(filename.c_str());
+        std::mt19937_64 random(users);
+        std::vector<std::wstring> names;
+        for (size_t i = 0; i < kLookupNames; ++i) {
+            names.emplace_back(database.GetUsername((UserId)(random() % database.UserCount())));
+        }
+
+        size_t next = 0;
+        for ([[maybe_unused]] auto _ : state) {
+            DoNotOptimize(database.Find(names[next++ % kLookupNames]));
+        }
+
+        state.items = 1;
+    }
+
+    // One flag change and the version it publishes. Read-only, so neither the journal nor compaction is timed
+    void BenchSetBlocked(State& state, size_t users) {
+        std::wstring filename = Dataset(users);
+        Database database(filename.c_str(), true, true);
+        std::mt19937_64 random(users);
+        for ([[maybe_unused]] auto _ : state) {
+            UserId id = (UserId)(random() % database.UserCount());
+            database.SetBlocked(id, !database.IsBlocked(id));
+        }
+
+        state.items = 1;
+    }
+
+    void BenchFindMissing(State& state, size_t users) {
+        std::wstring filename = Dataset(users);
+        Database database(filename.c_str());
+        std::vector<std::wstring> names;
+        for (size_t i = 0; i < kLookupNames; ++i) {
+            names.push_back(L"missing" + std::to_wstring(i));
+        }
+
+        size_t next = 0;
+        for ([[maybe_unused]] auto _ : state) {
+            DoNotOptimize(database.Find(names[next++ % kLookupNames]));
+        }
+
+        state.items = 1;
+    }
+
+    // Legacy stream format, users have plaintext passwords there
+    std::vector<User> StreamUsers() {
+        std::vector<User> users = GenerateUsers(0, kStreamUsers);
+        for (User& user : users) {
+            user.password = L"Passw0rd" + user.username.substr(0, 4);
+            user.passwordHash = PasswordHash();
+        }
+
+        return users;
+    }
+
+    void BenchStreamWrite(State& state) {
+        std::vector<User> users = StreamUsers();
+        std::string filename = std::filesystem::path(DatasetFilename(kStreamUsers, "stream")).string();
+        for ([[maybe_unused]] auto _ : state) {
+            std::ofstream ofs(filename, std::ios::binary | std::ios::trunc);
+            for (const User& user : users) {
+                ofs << user;
+            }
+        }
+
+        state.items = users.size();
+    }
+
+    void BenchStreamRead(State& state) {
+        std::vector<User> users = StreamUsers();
+        std::string filename = std::filesystem::path(DatasetFilename(kStreamUsers, "stream")).string();
+        {
+            std::ofstream ofs(filename, std::ios::binary | std::ios::trunc);
+            for (const User& user : users) {
+                ofs << user;
+            }
+        }
+
+        User user;
+        for ([[maybe_unused]] auto _ : state) {
+            std::ifstream ifs(filename, std::ios::binary);
+            for (size_t i = 0; i < users.size(); ++i) {
+                ifs >> user;
+            }
+
+            DoNotOptimize(user);
+        }
+
+        state.items = users.size();
+    }
+
+    void BenchSerialize(State& state) {
+        std::vector<User> users = GenerateUsers(0, kStreamUsers);
+        std::vector<char> buffer;
+        for ([[maybe_unused]] auto _ : state) {
+            buffer.clear();
+            for (const User& user : users) {
+                Serialize(buffer, user);
+            }
+
+            DoNotOptimize(buffer.data());
+        }
+
+        state.items = users.size();
+    }
+
+    void BenchDeserialize(State& state) {
+        std::vector<User> users = GenerateUsers(0, kStreamUsers);
+        std::vector<char> buffer;
+        for (const User& user : users) {
+            Serialize(buffer, user);
+        }
+
+        User user;
+        for ([[maybe_unused]] auto _ : state) {
+            const char* data = buffer.data();
+            const char* end = buffer.data() + buffer.size();
+            while (data != nullptr && data < end) {
+                data = Deserialize(data, end, user);
+            }
+
+            DoNotOptimize(data);
+        }
+
+        state.items = users.size();
+    }
+
+    void BenchPasswordValid(State& state, const std::vector<std::wstring>& passwords) {
+        size_t next = 0;
+        for ([[maybe_unused]] auto _ : state) {
+            DoNotOptimize(IsPasswordValid(passwords[next++ % passwords.size()]));
+        }
+
+        state.items = 1;
+    }
+
+    void BenchPasswordPolicy(State& state, const PasswordPolicy& policy, const std::vector<std::wstring>& passwords) {
+        size_t next = 0;
+        for ([[maybe_unused]] auto _ : state) {
+            DoNotOptimize(policy.IsValid(passwords[next++ % passwords.size()]));
+        }
+
+        state.items = 1;
+    }
+
+    void BenchHandshakeValid(State& state) {
+        int64_t input = 12345;
+        for ([[maybe_unused]] auto _ : state) {
+            DoNotOptimize(IsHandshakeValid(input, input * input + 3));
+            ++input;
+        }
+
+        state.items = 1;
+    }
+
+    // Successful login of a user with the cheapest allowed KDF, so the path around it shows
+    void BenchLogin(State& state) {
+        std::wstring filename = DatasetFilename(0, "login");
+        std::filesystem::remove(filename);
+        std::filesystem::remove(filename + L".log");
+        Database database(filename.c_str());
+        UserId id = database.AddUser(User(L"benchuser", L"", false, true));
+        database.SetPasswordHash(id, HashPassword(L"Passw0rd\x0444", kDefaultKdf, kMinKdfIterations));
+        AuthService auth(database);
+        LoginChallenge challenge = { auth.challenges.Issue(), kAttempts, 0 };
+        std::wstring response = std::to_wstring((int64_t)challenge.token.input * challenge.token.input + 3);
+        UserId user;
+        // Warm-up: first calls register per-thread reader and metrics slots
+        if (auth.Login(challenge, L"benchuser", L"Passw0rd\x0444", response, user) != AuthStatus::OK) {
+            fprintf(stderr, "Login benchmark setup failed\n");
+            return;
+        }
+
+        for ([[maybe_unused]] auto _ : state) {
+            DoNotOptimize(auth.Login(challenge, L"benchuser", L"Passw0rd\x0444", response, user));
+        }
+
+        state.items = 1;
+    }
+
+    // Check of a live session, what repeated actions pay instead of the password hash
+    void BenchValidateSession(State& state) {
+        SessionService sessions;
+        std::vector<SessionToken> tokens;
+        for (size_t i = 0; i < kLookupNames; ++i) {
+            tokens.push_back(sessions.Issue((UserId)i));
+        }
+
+        UserId user;
+        size_t next = 0;
+        for ([[maybe_unused]] auto _ : state) {
+            DoNotOptimize(sessions.Validate(tokens[next++ % kLookupNames], user));
+        }
+
+        state.items = 1;
+    }
+
+    // Password check with default KDF parameters, the cost a session avoids
+    void BenchVerifyPassword(State& state) {
+        std::wstring filename = DatasetFilename(0, "verify");
+        std::filesystem::remove(filename);
+        std::filesystem::remove(filename + L".log");
+        Database database(filename.c_str());
+        UserId id = database.AddUser(User(L"benchuser", L"", false, false));
+        database.SetPassword(id, L"Passw0rd\x0444");
+        for ([[maybe_unused]] auto _ : state) {
+            DoNotOptimize(database.VerifyPassword(id, L"Passw0rd\x0444"));
+        }
+
+        state.items = 1;
+    }
+
+    // Same check spread over all cores, items/s next to Auth/VerifyPassword shows the scaling
+    void BenchVerifyBatch(State& state) {
+        PasswordHash hash = HashPassword(L"Passw0rd\x0444");
+        std::vector<Credential> attempts(kVerifyBatchSize, Credential{ L"Passw0rd\x0444", &hash });
+        for ([[maybe_unused]] auto _ : state) {
+            DoNotOptimize(VerifyBatch(attempts));
+        }
+
+        state.items = kVerifyBatchSize;
+    }
+
+    std::vector<Benchmark> RegisterBenchmarks(size_t maxUsers) {
+        std::vector<Benchmark> benchmarks;
+        for (size_t users : kDatasetSizes) {
+            if (users > maxUsers) {
+                break;
+            }
+
+            std::string suffix = std::string("/").append(std::to_string(users));
+            benchmarks.push_back({ "Database/Load" + suffix, [users](State& state) { BenchLoad(state, users, 0); } });
+            benchmarks.push_back({ "Database/LoadSerial" + suffix, [users](State& state) { BenchLoad(state, users, 1); } });
+            benchmarks.push_back({ "Database/Save" + suffix, [users](State& state) { BenchSave(state, users); } });
+            benchmarks.push_back({ "Database/Find" + suffix, [users](State& state) { BenchFind(state, users); } });
+            benchmarks.push_back({ "Database/FindMissing" + suffix, [users](State& state) { BenchFindMissing(state, users); } });
+            benchmarks.push_back({ "Database/SetBlocked" + suffix, [users](State& state) { BenchSetBlocked(state, users); } });
+        }
+
+        // Durable commits per second: snapshot per mutation, journal sync per mutation, group commit of concurrent writers
+        benchmarks.push_back({ "Commit/Save", BenchCommitSave });
+        benchmarks.push_back({ "Commit/JournalSync/threads:8", [](State& state) { BenchCommitJournal(state, 0, kCommitThreads); } });
+        benchmarks.push_back({ "Commit/GroupCommit/threads:1", [](State& state) { BenchCommitJournal(state, kCommitLatencyUs, 1); } });
+        benchmarks.push_back({ "Commit/GroupCommit/threads:8", [](State& state) { BenchCommitJournal(state, kCommitLatencyUs, kCommitThreads); } });
+        benchmarks.push_back({ "User/StreamWrite", BenchStreamWrite });
+        benchmarks.push_back({ "User/StreamRead", BenchStreamRead });
+        benchmarks.push_back({ "User/Serialize", BenchSerialize });
+        benchmarks.push_back({ "User/Deserialize", BenchDeserialize });
+        // Typical passwords take the fast path, long ones exercise the 8-wide loop, last ones are rejected
+        std::vector<std::wstring> valid = { L"Passw0rd", L"\x041F\x0430\x0440\x043E\x043B\x044C" L"2024", L"Abc123" };
+        std::vector<std::wstring> longValid = { std::wstring(64, L'a') + L"\x0444" L"7", std::wstring(256, L'Z') + L"\x0416" L"0" };
+        std::vector<std::wstring> invalid = { L"Pass word1", L"NoCyrillic123", L"\x0444\x0444\x0444" };
+        benchmarks.push_back({ "Validation/IsPasswordValid/Short", [valid](State& state) { BenchPasswordValid(state, valid); } });
+        benchmarks.push_back({ "Validation/IsPasswordValid/Long", [longValid](State& state) { BenchPasswordValid(state, longValid); } });
+        benchmarks.push_back({ "Validation/IsPasswordValid/Invalid", [invalid](State& state) { BenchPasswordValid(state, invalid); } });
+        // Same passwords through the compiled default policy
+        benchmarks.push_back({ "Validation/PasswordPolicy/Short", [valid](State& state) { BenchPasswordPolicy(state, kDefaultPasswordPolicy, valid); }, true });
+        benchmarks.push_back({ "Validation/PasswordPolicy/Long", [longValid](State& state) { BenchPasswordPolicy(state, kDefaultPasswordPolicy, longValid); }, true });
+        benchmarks.push_back({ "Validation/PasswordPolicy/Invalid", [invalid](State& state) { BenchPasswordPolicy(state, kDefaultPasswordPolicy, invalid); }, true });
+        benchmarks.push_back({ "Validation/IsHandshakeValid", BenchHandshakeValid });
+        benchmarks.push_back({ "Auth/Login", BenchLogin, true });
+        benchmarks.push_back({ "Auth/ValidateSession", BenchValidateSession, true });
+        benchmarks.push_back({ "Auth/VerifyPassword", BenchVerifyPassword });
+        benchmarks.push_back({ "Auth/VerifyBatch", BenchVerifyBatch });
+        return benchmarks;
+    }
+
+    // Grows the iteration count until a run takes at least minTime, the way Google Benchmark does
+    Result RunBenchmark(const Benchmark& benchmark, double minTime) {
+        State state = {};
+        size_t iterations = 1;
+        while (true) {
+            state = {};
+            state.iterations = iterations;
+            benchmark.run(state);
+            if (state.realSeconds >= minTime || iterations >= 1000000000) {
+                break;
+            }
+
+            double multiplier = state.realSeconds <= 0 ? 100 : std::min(100.0, std::max(2.0, minTime * 1.4 / state.realSeconds));
+            iterations = (size_t)(iterations * multiplier);
+        }
+
+        Result result;
+        result.name = benchmark.name;
+        result.iterations = state.iterations;
+        result.realNs = state.realSeconds * 1e9 / state.iterations;
+        result.cpuNs = state.cpuSeconds * 1e9 / state.iterations;
+        result.itemsPerSecond = state.realSeconds > 0 ? state.items * state.iterations / state.realSeconds : 0;
+        result.allocationsPerIteration = (double)state.allocationCount / state.iterations;
+        return result;
+    }
+
+    void PrintJson(FILE* file, const char* executable, const std::vector<Result>& results) {
+        char date[64];
+        time_t now = time(nullptr);
+        strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+        fprintf(file, "{\n  \"context\": {\n");
+        fprintf(file, "    \"date\": \"%s\",\n", date);
+        fprintf(file, "    \"executable\": \"%s\",\n", executable);
+        fprintf(file, "    \"num_cpus\": %u,\n", std::thread::hardware_concurrency());
+#ifdef NDEBUG
+        fprintf(file, "    \"library_build_type\": \"release\"\n");
+#else
+        fprintf(file, "    \"library_build_type\": \"debug\"\n");
+#endif
+        fprintf(file, "  },\n  \"benchmarks\": [\n");
+        for (size_t i = 0; i < results.size(); ++i) {
+            const Result& result = results[i];
+            fprintf(file, "    {\n");
+            fprintf(file, "      \"name\": \"%s\",\n", result.name.c_str());
+            fprintf(file, "      \"run_name\": \"%s\",\n", result.name.c_str());
+            fprintf(file, "      \"run_type\": \"iteration\",\n");
+            fprintf(file, "      \"iterations\": %zu,\n", result.iterations);
+            fprintf(file, "      \"real_time\": %.3f,\n", result.realNs);
+            fprintf(file, "      \"cpu_time\": %.3f,\n", result.cpuNs);
+            fprintf(file, "      \"time_unit\": \"ns\",\n");
+            fprintf(file, "      \"items_per_second\": %.3f,\n", result.itemsPerSecond);
+            fprintf(file, "      \"allocations_per_iteration\": %.3f\n", result.allocationsPerIteration);
+            fprintf(file, "    }%s\n", i + 1 < results.size() ? "," : "");
+        }
+
+        fprintf(file, "  ]\n}\n");
+    }
+
+    void PrintConsoleHeader() {
+        printf("%-40s %15s %15s %12s %15s %12s\n", "Benchmark", "Time (ns)", "CPU (ns)", "Iterations", "Items/s", "Allocs/iter");
+    }
+
+    void PrintConsole(const Result& result) {
+        printf("%-40s %15.1f %15.1f %12zu %15.1f %12.2f\n", result.name.c_str(), result.realNs, result.cpuNs, result.iterations, result.itemsPerSecond,
+            result.allocationsPerIteration);
+        fflush(stdout);
+    }
+
+    const char* GetFlag(int argc, char** argv, const char* name) {
+        size_t length = strlen(name);
+        for (int i = 1; i < argc; ++i) {
+            if (strncmp(argv[i], name, length) == 0 && argv[i][length] == '=') {
+                return argv[i] + length + 1;
+            }
+        }
+
+        return nullptr;
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* filter = GetFlag(argc, argv, "--benchmark_filter");
+    const char* minTime = GetFlag(argc, argv, "--benchmark_min_time");
+    const char* format = GetFlag(argc, argv, "--benchmark_format");
+    const char* out = GetFlag(argc, argv, "--benchmark_out");
+    const char* maxUsers = GetFlag(argc, argv, "--max_users");
+    bool isJson = format != nullptr && strcmp(format, "json") == 0;
+    std::regex pattern(filter != nullptr ? filter : ".*");
+
+    std::vector<Result> results;
+    bool isAllocationFree = true;
+    if (!isJson) {
+        PrintConsoleHeader();
+    }
+
+    for (const Benchmark& benchmark : RegisterBenchmarks(maxUsers != nullptr ? strtoull(maxUsers, nullptr, 10) : SIZE_MAX)) {
+        if (!std::regex_search(benchmark.name, pattern)) {
+            continue;
+        }
+
+        results.push_back(RunBenchmark(benchmark, minTime != nullptr ? atof(minTime) : 0.5));
+        if (!isJson) {
+            PrintConsole(results.back());
+        }
+
+        if (benchmark.isAllocationFree && results.back().allocationsPerIteration != 0) {
+            fprintf(stderr, "%s allocates %.2f times per iteration, expected none\n", benchmark.name.c_str(), results.back().allocationsPerIteration);
+            isAllocationFree = false;
+        }
+    }
+
+    if (isJson) {
+        PrintJson(stdout, argv[0], results);
+    }
+
+    if (out != nullptr) {
+        FILE* file = fopen(out, "w");
+        if (file == nullptr) {
+            fprintf(stderr, "Can't write %s\n", out);
+            return 1;
+        }
+
+        PrintJson(file, argv[0], results);
+        fclose(file);
+    }
+
+    return isAllocationFree ? 0 : 1;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+// Growable bitset packed into 64-bit words
+struct Bitset {
+    void Resize(size_t size) {
+        words.resize((size + 63) >> 6, 0);
+    }
+
+    void Reset() {
+        std::fill(words.begin(), words.end(), 0);
+    }
+
+    bool Get(size_t position) const {
+        return (words[position >> 6] >> (position & 63)) & 1;
+    }
+
+    void Set(size_t position, bool value) {
+        uint64_t mask = 1ull << (position & 63);
+        if (value) {
+            words[position >> 6] |= mask;
+        }
+        else {
+            words[position >> 6] &= ~mask;
+        }
+    }
+
+    std::vector<uint64_t> words;
+};
@@ -0,0 +1,190 @@
+#include <chrono>
+#include <cstring>
+#include <random>
+
+#include "ChallengeService.h"
+#include "Constants.h"
+#include "Sha256.h"
+#include "Encoding.h"
+
+namespace {
+    ChallengeFunction challenges[256] = { IsHandshakeValid };
+
+    uint64_t NowMs() {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // xoshiro256**. Seeded from the OS generator per thread, then costs a few instructions per challenge
+    struct Random {
+        Random() {
+            std::random_device device;
+            for (uint64_t& word : state) {
+                word = ((uint64_t)device() << 32) | device();
+            }
+        }
+
+        uint64_t Next() {
+            uint64_t result = Rotate(state[1] * 5, 7) * 9;
+            uint64_t t = state[1] << 17;
+            state[2] ^= state[0];
+            state[3] ^= state[1];
+            state[1] ^= state[2];
+            state[0] ^= state[3];
+            state[2] ^= t;
+            state[3] = Rotate(state[3], 45);
+            return result;
+        }
+
+        static uint64_t Rotate(uint64_t x, int k) {
+            return (x << k) | (x >> (64 - k));
+        }
+
+        uint64_t state[4];
+    };
+
+    thread_local Random generator;
+
+    struct RandomKey {
+        RandomKey() {
+            std::random_device device;
+            for (uint8_t& byte : bytes) {
+                byte = (uint8_t)device();
+            }
+        }
+
+        uint8_t bytes[kSipHashKeySize];
+    };
+
+    void Write(uint8_t*& data, uint64_t value, size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            *data++ = (uint8_t)(value >> (8 * i));
+        }
+    }
+
+    uint64_t Read(const uint8_t*& data, size_t size) {
+        uint64_t value = 0;
+        for (size_t i = 0; i < size; ++i) {
+            value |= (uint64_t)*data++ << (8 * i);
+        }
+
+        return value;
+    }
+
+    void Serialize(const ChallengeToken& token, uint8_t (&data)[kChallengeTokenSize]) {
+        uint8_t* out = data;
+        Write(out, kChallengeVersion, 1);
+        Write(out, (uint8_t)token.kind, 1);
+        Write(out, token.input, 4);
+        Write(out, token.expires, 8);
+        memcpy(out, token.mac, kChallengeMacSize);
+    }
+}
+
+ChallengeService::ChallengeService()
+    : ChallengeService(RandomKey().bytes) {}
+
+ChallengeService::ChallengeService(const uint8_t (&key)[kSipHashKeySize])
+    : mac(key) {}
+
+ChallengeToken ChallengeService::Issue(ChallengeKind kind) const {
+    ChallengeToken token = {};
+    token.kind = kind;
+    token.input = (uint32_t)(generator.Next() % kChallengeRange);
+    token.expires = NowMs() + kChallengeLifetimeMs;
+    Sign(token, token.mac);
+    return token;
+}
+
+bool ChallengeService::Verify(const ChallengeToken& token, int64_t response) const {
+    uint8_t expected[kChallengeMacSize];
+    Sign(token, expected);
+    if (!ConstantTimeEqual(expected, token.mac, kChallengeMacSize) || token.expires < NowMs()) {
+        return false;
+    }
+
+    ChallengeFunction function = challenges[(uint8_t)token.kind];
+    return function != nullptr && function(token.input, response);
+}
+
+void ChallengeService::Sign(const ChallengeToken& token, uint8_t (&result)[kChallengeMacSize]) const {
+    // Everything but the mac itself
+    uint8_t data[kChallengeTokenSize];
+    Serialize(token, data);
+    mac.Sign(data, kChallengeTokenSize - kChallengeMacSize, result);
+}
+
+void RegisterChallenge(ChallengeKind kind, ChallengeFunction function) {
+    challenges[(uint8_t)kind] = function;
+}
+
+std::string EncodeToken(const ChallengeToken& token) {
+    static const char kDigits[] = "0123456789abcdef";
+    uint8_t data[kChallengeTokenSize];
+    Serialize(token, data);
+    std::string text(kChallengeTokenSize * 2, '0');
+    for (size_t i = 0; i < kChallengeTokenSize; ++i) {
+        text[2 * i] = kDigits[data[i] >> 4];
+        text[2 * i + 1] = kDigits[data[i] & 15];
+    }
+
+    return text;
+}
+
+bool DecodeToken(std::string_view text, ChallengeToken& token) {
+    uint8_t data[kChallengeTokenSize];
+    if (text.length() != kChallengeTokenSize * 2) {
+        return false;
+    }
+
+    for (size_t i = 0; i < kChallengeTokenSize; ++i) {
+        int high = HexDigit(text[2 * i]);
+        int low = HexDigit(text[2 * i + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+
+        data[i] = (uint8_t)((high << 4) | low);
+    }
+
+    const uint8_t* in = data;
+    if (Read(in, 1) != kChallengeVersion) {
+        return false;
+    }
+
+    token.kind = (ChallengeKind)Read(in, 1);
+    token.input = (uint32_t)Read(in, 4);
+    token.expires = Read(in, 8);
+    memcpy(token.mac, in, kChallengeMacSize);
+    return true;
+}
+
+bool ParseResponse(std::wstring_view text, int64_t& value) {
+    size_t i = 0;
+    bool isNegative = false;
+    if (i < text.length() && (text[i] == L'-' || text[i] == L'+')) {
+        isNegative = text[i] == L'-';
+        ++i;
+    }
+
+    if (i == text.length()) {
+        return false;
+    }
+
+    uint64_t limit = isNegative ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+    uint64_t result = 0;
+    for (; i < text.length(); ++i) {
+        if (text[i] < L'0' || text[i] > L'9') {
+            return false;
+        }
+
+        uint64_t digit = (uint64_t)(text[i] - L'0');
+        if (result > (limit - digit) / 10) {
+            return false;
+        }
+
+        result = result * 10 + digit;
+    }
+
+    value = isNegative ? (int64_t)(0 - result) : (int64_t)result;
+    return true;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+#include "SipHash.h"
+
+enum class ChallengeKind : uint8_t {
+    SQUARE_PLUS_THREE // Individual task: response = input^2 + 3
+};
+
+constexpr ChallengeKind kDefaultChallenge = ChallengeKind::SQUARE_PLUS_THREE;
+// Inputs are small enough to answer in the head
+constexpr uint32_t kChallengeRange = 1000;
+constexpr uint64_t kChallengeLifetimeMs = 5 * 60 * 1000;
+constexpr uint8_t kChallengeVersion = 1;
+constexpr size_t kChallengeMacSize = kSipHash128Size;
+// Serialized token: [version][kind][input][expires][mac], integers are little-endian
+constexpr size_t kChallengeTokenSize = 1 + 1 + 4 + 8 + kChallengeMacSize;
+
+// True if response solves the challenge
+using ChallengeFunction = bool (*)(int64_t input, int64_t response);
+
+// Issued challenge. It is signed, so the issuer verifies it later without remembering it
+struct ChallengeToken {
+    ChallengeKind kind;
+    uint32_t input;
+    // Milliseconds since 1970
+    uint64_t expires;
+    uint8_t mac[kChallengeMacSize];
+};
+
+// Stateless handshake challenges. Thread-safe
+struct ChallengeService {
+    // Signs with a random key, so tokens don't survive a restart
+    ChallengeService();
+    ChallengeService(const uint8_t (&key)[kSipHashKeySize]);
+
+    ChallengeToken Issue(ChallengeKind kind = kDefaultChallenge) const;
+    // False if token is forged, expired, of unknown kind or response is wrong
+    bool Verify(const ChallengeToken& token, int64_t response) const;
+
+    SipHash128 mac;
+
+private:
+    void Sign(const ChallengeToken& token, uint8_t (&mac)[kChallengeMacSize]) const;
+};
+
+// Replaces the check of a challenge kind
+void RegisterChallenge(ChallengeKind kind, ChallengeFunction function);
+// Hex text for line protocols
+std::string EncodeToken(const ChallengeToken& token);
+bool DecodeToken(std::string_view text, ChallengeToken& token);
+// Decimal number. False on empty input, garbage or overflow
+bool ParseResponse(std::wstring_view text, int64_t& value);
@@ -1,34 +1,147 @@
+#include <cwctype>
 #include <string>
 
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define PASSWORD_SIMD
+#endif
+
 #include "Constants.h"
+#include "PasswordPolicy.h"
+
+namespace {
+    constexpr unsigned kLatin = 1 << 0;
+    constexpr unsigned kCyrillic = 1 << 1;
+    constexpr unsigned kDigit = 1 << 2;
+    // ASCII that isn't a letter or digit. Invalid in any locale
+    constexpr unsigned kInvalid = 1 << 3;
+    // Needs the locale-dependent check
+    constexpr unsigned kUnknown = 1 << 4;
+
+    // Cyrillic block without U+0482..U+0489 (sign and combining marks)
+    inline bool IsCyrillicLetter(wchar_t ch) {
+        return (ch >= 0x0400 && ch <= 0x0481) || (ch >= 0x048A && ch <= 0x04FF);
+    }
+
+    inline unsigned Classify(wchar_t ch) {
+        if ((ch >= L'a' && ch <= L'z') || (ch >= L'A' && ch <= L'Z')) {
+            return kLatin;
+        }
+
+        if (ch >= L'0' && ch <= L'9') {
+            return kDigit;
+        }
 
-bool IsPasswordValid(const std::wstring& password) {
-    bool hasLatin = false;
-    bool hasCyrillic = false;
-    bool hasNumbers = false;
-    for (wchar_t ch : password) {
-        if (iswalpha(ch)) {
-            if (iswascii(ch)) {
-                hasLatin = true;
+        if (ch < 0x80) {
+            return kInvalid;
+        }
+
+        return IsCyrillicLetter(ch) ? kCyrillic : kUnknown;
+    }
+
+    // Original per-character check. Used for characters outside the ranges classified above
+    bool IsPasswordValidSlow(std::wstring_view password) {
+        bool hasLatin = false;
+        bool hasCyrillic = false;
+        bool hasNumbers = false;
+        for (wchar_t ch : password) {
+            if (iswalpha(ch)) {
+                if (ch < 0x80) {
+                    hasLatin = true;
+                }
+                else if (ch >= 0x0400 && ch <= 0x04FF) {
+                    hasCyrillic = true;
+                }
+                else {
+                    return false;
+                }
             }
-            else if (ch >= 0x0400 && ch <= 0x04FF) {
-                hasCyrillic = true;
+            else if (iswdigit(ch)) {
+                hasNumbers = true;
             }
             else {
                 return false;
             }
         }
-        else if (iswdigit(ch)) {
-            hasNumbers = true;
+
+        return hasLatin && hasCyrillic && hasNumbers;
+    }
+
+#ifdef PASSWORD_SIMD
+    // Lanes where (value - low) <= high - low, unsigned
+    inline __m128i InRange16(__m128i value, short low, short high) {
+        __m128i offset = _mm_sub_epi16(value, _mm_set1_epi16(low));
+        return _mm_cmpeq_epi16(_mm_subs_epu16(offset, _mm_set1_epi16((short)(high - low))), _mm_setzero_si128());
+    }
+
+    // 8 characters as 16-bit lanes. 4-byte characters are packed with signed saturation,
+    // so everything above U+7FFF becomes 0x7FFF, which is in no class and sends the password to the slow path
+    inline __m128i LoadChars(const wchar_t* data) {
+        if constexpr (sizeof(wchar_t) == 2) {
+            return _mm_loadu_si128((const __m128i*)data);
         }
         else {
-            return false;
+            return _mm_packs_epi32(_mm_loadu_si128((const __m128i*)data), _mm_loadu_si128((const __m128i*)(data + 4)));
+        }
+    }
+
+    // Classifies 8 characters per step
+    unsigned ClassifySimd(const wchar_t* data, size_t& length) {
+        unsigned classes = 0;
+        size_t i = 0;
+        for (; i + 8 <= length; i += 8) {
+            __m128i chars = LoadChars(data + i);
+            __m128i latin = InRange16(_mm_or_si128(chars, _mm_set1_epi16(0x20)), L'a', L'z');
+            __m128i digit = InRange16(chars, L'0', L'9');
+            __m128i cyrillic = _mm_or_si128(InRange16(chars, 0x0400, 0x0481), InRange16(chars, 0x048A, 0x04FF));
+            __m128i ascii = InRange16(chars, 0, 0x7F);
+            __m128i known = _mm_or_si128(latin, digit);
+            classes |= _mm_movemask_epi8(latin) != 0 ? kLatin : 0;
+            classes |= _mm_movemask_epi8(digit) != 0 ? kDigit : 0;
+            classes |= _mm_movemask_epi8(cyrillic) != 0 ? kCyrillic : 0;
+            classes |= _mm_movemask_epi8(_mm_andnot_si128(known, ascii)) != 0 ? kInvalid : 0;
+            classes |= _mm_movemask_epi8(_mm_andnot_si128(_mm_or_si128(cyrillic, ascii), _mm_set1_epi8(-1))) != 0 ? kUnknown : 0;
+            if ((classes & kInvalid) != 0) {
+                break;
+            }
         }
+
+        length = i;
+        return classes;
+    }
+#endif
+}
+
+bool IsPasswordValid(std::wstring_view password) {
+    unsigned classes = 0;
+    size_t done = password.length();
+#ifdef PASSWORD_SIMD
+    classes = ClassifySimd(password.data(), done);
+#else
+    done = 0;
+#endif
+
+    for (size_t i = done; i < password.length() && (classes & kInvalid) == 0; ++i) {
+        classes |= Classify(password[i]);
+    }
+
+    if ((classes & kInvalid) != 0) {
+        return false;
     }
 
-    return hasLatin && hasCyrillic && hasNumbers;
+    if ((classes & kUnknown) != 0) {
+        return IsPasswordValidSlow(password);
+    }
+
+    return (classes & (kLatin | kCyrillic | kDigit)) == (kLatin | kCyrillic | kDigit);
+}
+
+std::vector<uint8_t> ValidatePasswords(std::span<const std::wstring_view> passwords) {
+    std::vector<uint8_t> results(passwords.size());
+    kDefaultPasswordPolicy.ValidateAll(passwords, results);
+    return results;
 }
 
-bool IsHandshakeValid(int input, int output) {
+bool IsHandshakeValid(int64_t input, int64_t output) {
     return output == (input * input + 3);
 }
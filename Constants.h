@@ -1,11 +1,28 @@
 #pragma once
 
 #include <string>
+#include <string_view>
+#include <span>
+#include <vector>
+#include <cstdint>
 
 constexpr const wchar_t* kDatabaseFile = L"users.dat";
+constexpr const wchar_t* kRateLimitFile = L"ratelimit.dat";
+// Prometheus text format, for the node_exporter textfile collector
+constexpr const wchar_t* kMetricsFile = L"metrics.prom";
+constexpr const int kMetricsIntervalMs = 10000;
 constexpr const wchar_t* kAdminUsername = L"ADMIN";
-constexpr const wchar_t* kAboutMessage = L"Made by Kostin A.S. student of CS-920d group.\n\nIndividual Task:\nPassword type: Handshake\nPassword restrictions: Password should have latin, cyrillic symbols and digits";
+constexpr const wchar_t* kAboutMessage = L"Made by Kostin A.S. student of CS-920d group.\n\nIndividual Task:\nPassword type: Handshake\nPassword restrictions: ";
 constexpr const int kAttempts = 3;
+// Admin user list falls back to usernames within this many edits of the search text
+constexpr size_t kSearchDistance = 2;
+constexpr size_t kSearchResults = 1000;
 
-bool IsPasswordValid(const std::wstring& password);
-bool IsHandshakeValid(int input, int output);
+// Hand-written check of the rule kDefaultPasswordPolicy describes, classifying 8 characters at a time.
+// Kept as the benchmark baseline, authentication uses the policy
+bool IsPasswordValid(std::wstring_view password);
+// Result is 1 for every valid password.
+// Deprecated: only knows the default rule, use PasswordPolicy::ValidateAll of the policy in force
+[[deprecated("Use PasswordPolicy::ValidateAll")]]
+std::vector<uint8_t> ValidatePasswords(std::span<const std::wstring_view> passwords);
+bool IsHandshakeValid(int64_t input, int64_t output);
@@ -1,45 +1,1272 @@
-#include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <bit>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <unordered_set>
 
 #include "Database.h"
 #include "Constants.h"
+#include "Rcu.h"
+#include "FileUtils.h"
+#include "Encoding.h"
+#include "Metrics.h"
+#include "SipHash.h"
 
-Database::Database(const wchar_t* filename)
-    : filename(filename) {
-    std::ifstream file(filename, std::ios::binary);
-    if (file.is_open()) {
-        file >> *this;
+namespace {
+    struct RandomKey {
+        RandomKey() {
+            std::random_device device;
+            for (uint8_t& byte : bytes) {
+                byte = (uint8_t)device();
+            }
+        }
+
+        uint8_t bytes[kSipHashKeySize];
+    };
+
+    // Usernames come from the network and from imports. Keyed per process, so nobody can pick names that share a probe chain
+    const SipHash64 usernameHash(RandomKey().bytes);
+
+    size_t HashUsername(std::wstring_view username) {
+        return (size_t)usernameHash.Hash(username.data(), username.length() * sizeof(wchar_t));
+    }
+
+    // Splits sorted ids into equal pages of at most kOrderPageSize
+    void AppendPages(std::vector<std::shared_ptr<const std::vector<UserId>>>& order, const std::vector<UserId>& ids) {
+        size_t pages = (ids.size() + kOrderPageSize - 1) / kOrderPageSize;
+        for (size_t page = 0; page < pages; ++page) {
+            auto first = ids.begin() + ids.size() * page / pages;
+            auto last = ids.begin() + ids.size() * (page + 1) / pages;
+            order.push_back(std::make_shared<const std::vector<UserId>>(first, last));
+        }
+    }
+}
+
+Database::Database(const wchar_t* filename, bool withAdmin, bool isReadOnly)
+    : filename(filename), isCorrupted(false), isReadOnly(isReadOnly), maxUsers(kInvalidUser), dirtyUsers(0), savesWritten(0), savesSkipped(0), savesFailed(0), writesSkipped(0),
+    current(new Version()),
+    journalFilename(std::wstring(filename) + L".log"), journal(nullptr), journalRecords(0), compactRecords(kJournalCompactThreshold), appendedRecords(0), durableRecords(0),
+    flushRecords(0), commitLatencyUs(kCommitLatencyUs), commitBatchBytes(kCommitBatchBytes), isCommitterStopping(false) {
+    METRICS_TIME(Timer::DATABASE_OPEN);
+    std::vector<char> buffer;
+    if (FileReadAll(filename, buffer) && !Load(buffer.data(), buffer.data() + buffer.size())) {
+        // Snapshots are replaced atomically, so this is real damage. Stop instead of saving a partial user list over it
+        isCorrupted = true;
+        return;
+    }
+
+    bool isJournalValid = !FileReadAll(journalFilename.c_str(), buffer) || Replay(buffer.data(), buffer.data() + buffer.size());
+    bool hasPlaintext = !pendingPasswords.empty();
+    HashPendingPasswords();
+    if (!isJournalValid || hasPlaintext) {
+        // New records can't be appended after a legacy or torn journal, and plaintext passwords shouldn't stay on disk.
+        // Fold everything into a v2 snapshot
+        Compact();
+    }
+
+    Publish();
+    committer = std::thread(&Database::RunCommitter, this);
+    if (withAdmin && Find(kAdminUsername) == kInvalidUser) {
+        AddUser(User(kAdminUsername, L"", false, false));
+    }
+}
+
+Database::~Database() {
+    {
+        std::lock_guard<std::mutex> guard(commitLock);
+        isCommitterStopping = true;
+    }
+
+    // Committer writes what is pending before it exits
+    commitRequested.notify_one();
+    if (committer.joinable()) {
+        committer.join();
+    }
+
+    if (journal != nullptr) {
+        fclose(journal);
+    }
+
+    // Readers can't outlive the database
+    for (std::pair<uint64_t, const Version*>& version : retired) {
+        delete version.second;
+    }
+
+    delete current.load();
+}
+
+bool Database::Save() {
+    std::lock_guard<std::mutex> guard(writeLock);
+    if (dirtyUsers == 0) {
+        ++savesSkipped;
+        METRICS_COUNT(Counter::SAVES_SKIPPED);
+        return true;
+    }
+
+    METRICS_TIME(Timer::DATABASE_SAVE);
+    return Compact();
+}
+
+void Database::Flush() {
+    std::unique_lock<std::mutex> lock(commitLock);
+    uint64_t records = appendedRecords;
+    if (durableRecords >= records) {
+        return;
+    }
+
+    // Closes the current window early
+    flushRecords = std::max(flushRecords, records);
+    commitRequested.notify_one();
+    committed.wait(lock, [this, records]() { return durableRecords >= records; });
+}
+
+void Database::SetCommitWindow(uint32_t latencyUs, size_t batchBytes) {
+    std::lock_guard<std::mutex> guard(commitLock);
+    commitLatencyUs = latencyUs;
+    commitBatchBytes = batchBytes;
+}
+
+bool Database::Compact() {
+    if (isCorrupted || isReadOnly) {
+        return !isCorrupted;
+    }
+
+    // Journal on disk must be complete up to the snapshot. A crash before it's cleared would otherwise replay
+    // a stale record over a newer state
+    CommitJournal();
+    std::wstring tempFilename = std::wstring(filename) + L".tmp";
+    FILE* file = FileOpen(tempFilename.c_str(), L"wb");
+    if (file == nullptr) {
+        compactRecords = journalRecords + kJournalCompactThreshold;
+        ++savesFailed;
+        METRICS_COUNT(Counter::SAVES_FAILED);
+        return false;
+    }
+
+    std::vector<char> buffer(kSnapshotMagic, kSnapshotMagic + sizeof(kSnapshotMagic));
+    buffer.push_back((char)kFormatVersion);
+    std::vector<char> payload;
+    const Version& version = Head();
+    bool written = true;
+    for (size_t first = 0; first < version.userCount && written; first += kBlockRecords) {
+        size_t last = std::min(first + kBlockRecords, version.userCount);
+        payload.clear();
+        for (UserId id = (UserId)first; id < last; ++id) {
+            Serialize(payload, version.GetUsername(id), version.GetPasswordHash(id), version.IsBlocked(id), version.IsRestrictionEnabled(id));
+        }
+
+        WriteVarint(buffer, last - first);
+        WriteVarint(buffer, payload.size());
+        buffer.insert(buffer.end(), payload.begin(), payload.end());
+        WriteUint32(buffer, Crc32c(payload.data(), payload.size()));
+        if (buffer.size() >= kSnapshotWriteSize) {
+            written = FileWrite(file, buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    }
+
+    written = written && FileWrite(file, buffer.data(), buffer.size()) && FileSync(file);
+    fclose(file);
+    // Old snapshot stays in place until the new one is complete on disk
+    if (!written || !FileReplace(tempFilename.c_str(), filename)) {
+        compactRecords = journalRecords + kJournalCompactThreshold;
+        ++savesFailed;
+        METRICS_COUNT(Counter::SAVES_FAILED);
+        return false;
+    }
+
+    // Snapshot contains everything. Start a new journal
+    std::lock_guard<std::mutex> fileGuard(journalLock);
+    if (journal != nullptr) {
+        fclose(journal);
+    }
+
+    journal = FileOpen(journalFilename.c_str(), L"wb");
+    if (journal != nullptr) {
+        FileWrite(journal, kJournalMagic, sizeof(kJournalMagic));
+        FileWrite(journal, (const char*)&kFormatVersion, sizeof(kFormatVersion));
+        FileSync(journal);
+    }
+
+    journalRecords = 0;
+    compactRecords = kJournalCompactThreshold;
+    dirty.Reset();
+    dirtyUsers = 0;
+    ++savesWritten;
+    return true;
+}
+
+bool Database::Load(const char* data, const char* end, size_t threadCount) {
+    std::lock_guard<std::mutex> guard(writeLock);
+    // Start from an empty version that is only published once the whole image decoded.
+    // Old username pools stay, readers may still hold views into them
+    next = std::make_unique<Version>();
+    ownedPages.clear();
+    ownedChunks.clear();
+    size_t pools = usernamePools.size();
+    std::vector<std::pair<UserId, std::wstring>> oldPendingPasswords = std::move(pendingPasswords);
+    Bitset oldDirty = std::move(dirty);
+    pendingPasswords.clear();
+    dirty.words.clear();
+    bool isValid;
+    if ((size_t)(end - data) > sizeof(kSnapshotMagic) && memcmp(data, kSnapshotMagic, sizeof(kSnapshotMagic)) == 0) {
+        isValid = data[sizeof(kSnapshotMagic)] == (char)kFormatVersion && LoadBlocks(data + sizeof(kSnapshotMagic) + 1, end, threadCount);
     }
     else {
-        users.emplace_back(std::make_unique<User>(kAdminUsername, L"", false, false));
+        isValid = LoadLegacy(data, end);
+    }
+
+    if (!isValid) {
+        // Nothing published points into the new pools
+        next.reset();
+        usernamePools.resize(pools);
+        pendingPasswords = std::move(oldPendingPasswords);
+        dirty = std::move(oldDirty);
+        return false;
     }
+
+    RebuildIndex();
+    RebuildOrder();
+    dirtyUsers = 0;
+    Publish();
+    return true;
 }
 
-void Database::Save() const {
-    std::ofstream newFile(filename, std::ios::binary | std::ios::trunc);
-    newFile << *this;
+bool Database::LoadBlocks(const char* data, const char* end, size_t threadCount) {
+    // Headers are cheap to walk, so find all blocks first and decode them in parallel
+    std::vector<Block> blocks;
+    while (data < end) {
+        Block block = {};
+        uint64_t length;
+        data = ReadVarint(data, end, block.count);
+        data = data == nullptr ? nullptr : ReadVarint(data, end, length);
+        // Blocks must cover the file exactly. Anything else is a torn or damaged file, fail before decoding
+        if (data == nullptr || length > (uint64_t)(end - data) || ReadUint32(data + length, end, block.crc) == nullptr) {
+            return false;
+        }
+
+        block.data = data;
+        block.end = data + length;
+        blocks.push_back(std::move(block));
+        data += length + sizeof(block.crc);
+    }
+
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    threadCount = std::min(threadCount, blocks.size());
+    if (blocks.size() < kParallelLoadBlocks || threadCount < 2) {
+        for (Block& block : blocks) {
+            DecodeBlock(block);
+        }
+    }
+    else {
+        std::atomic<size_t> next = 0;
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < threadCount; ++i) {
+            threads.emplace_back([&blocks, &next]() {
+                for (size_t block = next++; block < blocks.size(); block = next++) {
+                    DecodeBlock(blocks[block]);
+                }
+            });
+        }
+
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+
+    size_t userCount = 0;
+    for (const Block& block : blocks) {
+        if (!block.isValid) {
+            return false;
+        }
+
+        userCount += block.usernames.size();
+    }
+
+    dirty.Resize(userCount);
+    Version& version = Edit();
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        Block& block = blocks[i];
+        UserId firstId = (UserId)version.userCount;
+        // Block pool becomes a username pool as is. Moving a vector keeps its buffer, so views stay valid
+        usernamePools.push_back(std::move(block.usernamePool));
+        const wchar_t* pool = usernamePools.back().data();
+        for (std::pair<size_t, std::wstring>& plaintext : block.plaintext) {
+            pendingPasswords.emplace_back(firstId + (UserId)plaintext.first, std::move(plaintext.second));
+        }
+
+        for (size_t record = 0; record < block.usernames.size(); ++record) {
+            UserId id = (UserId)version.userCount++;
+            Chunk& chunk = EditChunk(id);
+            chunk.usernames.push_back(std::wstring_view(pool + block.usernames[record].offset, block.usernames[record].length));
+            chunk.passwords.emplace_back();
+            SetPasswordHashColumn(id, block.passwords[record]);
+            SetFlag(id, AccountFlag::BLOCKED, (block.flags[record] & kUserBlocked) != 0);
+            SetFlag(id, AccountFlag::RESTRICTED, (block.flags[record] & kUserRestrictionEnabled) != 0);
+        }
+
+        block = Block();
+    }
+
+    return true;
 }
 
-std::ofstream& operator<<(std::ofstream& ofs, const Database& database) {
-    // Format: [size][user0]...
-    size_t size = database.users.size();
-    ofs.write((const char*)&size, sizeof(size));
-    for (size_t i = 0; i < size; ++i) {
-        ofs << *database.users[i];
+void Database::DecodeBlock(Block& block) {
+    block.isValid = false;
+    if (Crc32c(block.data, (size_t)(block.end - block.data)) != block.crc) {
+        return;
     }
 
-    return ofs;
+    // Every record takes at least three bytes
+    size_t capacity = std::min<size_t>(block.count, (size_t)(block.end - block.data) / 3);
+    block.usernames.reserve(capacity);
+    block.passwords.reserve(capacity);
+    block.flags.reserve(capacity);
+    User record;
+    const char* data = block.data;
+    for (uint64_t i = 0; i < block.count; ++i) {
+        data = Deserialize(data, block.end, record);
+        if (data == nullptr) {
+            return;
+        }
+
+        if (record.passwordHash.algorithm == KdfAlgorithm::NONE && !record.password.empty()) {
+            block.plaintext.emplace_back(block.usernames.size(), std::move(record.password));
+        }
+
+        block.usernames.push_back(AppendString(block.usernamePool, record.username));
+        block.passwords.push_back(record.passwordHash);
+        block.flags.push_back((record.isBlocked ? kUserBlocked : 0) | (record.isRestrictionEnabled ? kUserRestrictionEnabled : 0));
+    }
+
+    block.isValid = data == block.end;
 }
 
-std::ifstream& operator>>(std::ifstream& ifs, Database& database) {
+bool Database::LoadLegacy(const char* data, const char* end) {
     size_t size;
-    ifs.read((char*)&size, sizeof(size));
-    database.users.resize(size);
-    User* user;
+    // Empty file is an empty database
+    if ((size_t)(end - data) < sizeof(size)) {
+        return data == end;
+    }
+
+    memcpy(&size, data, sizeof(size));
+    data += sizeof(size);
+    // Every record takes at least two lengths and two flags. Don't trust size from a damaged file
+    if (size > (size_t)(end - data) / (2 * sizeof(size_t) + 2 * sizeof(bool))) {
+        return false;
+    }
+
+    User record;
     for (size_t i = 0; i < size; ++i) {
-        user = new User();
-        ifs >> *user;
-        database.users[i].reset(user);
+        data = DeserializeLegacy(data, end, record);
+        if (data == nullptr) {
+            return false;
+        }
+
+        Push(record);
+    }
+
+    return data == end;
+}
+
+UserId Database::Find(std::wstring_view username) const {
+    ReadSection section;
+    return current.load()->Find(username);
+}
+
+UserId Database::AddUser(const User& user) {
+    std::lock_guard<std::mutex> guard(writeLock);
+    // Snapshot stores names as UTF-8, one it can't take back would make the file unloadable
+    if (!IsValidUnicode(user.username) || Head().userCount >= maxUsers || Head().Find(user.username) != kInvalidUser) {
+        return kInvalidUser;
+    }
+
+    UserId id = Insert(user);
+    HashPendingPasswords();
+    Publish();
+    Append(JournalRecord::ADD, id);
+    return id;
+}
+
+std::vector<UserId> Database::AddUsers(const std::vector<User>& users) {
+    std::lock_guard<std::mutex> guard(writeLock);
+    std::vector<UserId> ids;
+    std::vector<UserId> added;
+    ids.reserve(users.size());
+    for (const User& user : users) {
+        // Draft index already has earlier users of the batch
+        if (!IsValidUnicode(user.username) || Head().userCount >= maxUsers || Head().Find(user.username) != kInvalidUser) {
+            ids.push_back(kInvalidUser);
+            continue;
+        }
+
+        UserId id = Push(user);
+        IndexUser(id);
+        ids.push_back(id);
+        added.push_back(id);
+    }
+
+    MergeOrder(added);
+    HashPendingPasswords();
+    Publish();
+    AppendBatch(JournalRecord::ADD, added);
+    return ids;
+}
+
+void Database::SetPassword(UserId id, std::wstring_view password) {
+    // KDF is slow, run it before taking the lock
+    SetPasswordHash(id, HashPassword(password));
+}
+
+bool Database::SetInitialPassword(UserId id, std::wstring_view password) {
+    PasswordHash passwordHash = HashPassword(password);
+    std::lock_guard<std::mutex> guard(writeLock);
+    if (Head().GetPasswordHash(id).algorithm != KdfAlgorithm::NONE) {
+        ++writesSkipped;
+        return false;
+    }
+
+    SetPasswordHashColumn(id, passwordHash);
+    Publish();
+    Append(JournalRecord::SET_PASSWORD, id);
+    return true;
+}
+
+void Database::SetPasswordHash(UserId id, const PasswordHash& passwordHash) {
+    std::lock_guard<std::mutex> guard(writeLock);
+    SetPasswordHashColumn(id, passwordHash);
+    Publish();
+    Append(JournalRecord::SET_PASSWORD, id);
+}
+
+void Database::SetBlocked(UserId id, bool isBlocked) {
+    std::lock_guard<std::mutex> guard(writeLock);
+    if (Head().IsBlocked(id) == isBlocked) {
+        ++writesSkipped;
+        return;
+    }
+
+    SetFlag(id, AccountFlag::BLOCKED, isBlocked);
+    Publish();
+    Append(JournalRecord::SET_BLOCKED, id);
+}
+
+void Database::SetRestrictionEnabled(UserId id, bool isRestrictionEnabled) {
+    std::lock_guard<std::mutex> guard(writeLock);
+    if (Head().IsRestrictionEnabled(id) == isRestrictionEnabled) {
+        ++writesSkipped;
+        return;
+    }
+
+    SetFlag(id, AccountFlag::RESTRICTED, isRestrictionEnabled);
+    Publish();
+    Append(JournalRecord::SET_RESTRICTION, id);
+}
+
+size_t Database::UserCount() const {
+    ReadSection section;
+    return current.load()->userCount;
+}
+
+std::wstring_view Database::GetUsername(UserId id) const {
+    ReadSection section;
+    return current.load()->GetUsername(id);
+}
+
+PasswordHash Database::GetPasswordHash(UserId id) const {
+    ReadSection section;
+    return current.load()->GetPasswordHash(id);
+}
+
+bool Database::HasPassword(UserId id) const {
+    ReadSection section;
+    return current.load()->GetPasswordHash(id).algorithm != KdfAlgorithm::NONE;
+}
+
+bool Database::VerifyPassword(UserId id, std::wstring_view password) const {
+    return ::VerifyPassword(password, GetPasswordHash(id));
+}
+
+bool Database::IsBlocked(UserId id) const {
+    ReadSection section;
+    return current.load()->IsBlocked(id);
+}
+
+bool Database::IsRestrictionEnabled(UserId id) const {
+    ReadSection section;
+    return current.load()->IsRestrictionEnabled(id);
+}
+
+bool Database::IsDirty(UserId id) const {
+    std::lock_guard<std::mutex> guard(writeLock);
+    return dirty.Get(id);
+}
+
+template<typename Callback>
+void Database::Version::ForEachFlagged(AccountFlag flag, UserId from, Callback callback) const {
+    for (size_t chunk = from / kChunkUsers; chunk < ChunkCount(); ++chunk) {
+        if (GetChunk(chunk).flagCounts[(size_t)flag] == 0) {
+            continue;
+        }
+
+        const std::vector<uint64_t>& words = GetChunk(chunk).flags[(size_t)flag].words;
+        UserId base = (UserId)(chunk * kChunkUsers);
+        for (size_t word = 0; word < words.size(); ++word) {
+            uint64_t bits = words[word];
+            // Drop ids before from in its own word
+            UserId wordBase = base + (UserId)(word << 6);
+            if (from > wordBase) {
+                bits = from - wordBase >= 64 ? 0 : bits & (~0ull << (from - wordBase));
+            }
+
+            while (bits != 0) {
+                if (!callback(wordBase + (UserId)std::countr_zero(bits))) {
+                    return;
+                }
+
+                bits &= bits - 1;
+            }
+        }
+    }
+}
+
+size_t Database::CountFlagged(AccountFlag flag) const {
+    ReadSection section;
+    return current.load()->flagCounts[(size_t)flag];
+}
+
+size_t Database::GetFlagged(AccountFlag flag, UserId from, size_t count, UserId* ids) const {
+    if (count == 0) {
+        return 0;
+    }
+
+    ReadSection section;
+    size_t written = 0;
+    current.load()->ForEachFlagged(flag, from, [&written, count, ids](UserId id) {
+        ids[written++] = id;
+        return written < count;
+    });
+    return written;
+}
+
+size_t Database::SetBlockedWhere(AccountFlag flag, bool isBlocked) {
+    return SetFlagWhere(flag, AccountFlag::BLOCKED, isBlocked);
+}
+
+size_t Database::SetRestrictionEnabledWhere(AccountFlag flag, bool isRestrictionEnabled) {
+    return SetFlagWhere(flag, AccountFlag::RESTRICTED, isRestrictionEnabled);
+}
+
+UserId Database::Version::GetUserAt(size_t position) const {
+    size_t group = std::upper_bound(orderStarts.begin(), orderStarts.end(), position) - orderStarts.begin() - 1;
+    const OrderGroup& pages = *order[group];
+    position -= orderStarts[group];
+    size_t page = std::upper_bound(pages.starts.begin(), pages.starts.end(), position) - pages.starts.begin() - 1;
+    return (*pages.pages[page])[position - pages.starts[page]];
+}
+
+template<typename Predicate>
+size_t Database::Version::PartitionPoint(Predicate isBefore) const {
+    // Groups and pages that end before the point are skipped whole
+    auto group = std::partition_point(order.begin(), order.end(),
+        [this, &isBefore](const std::shared_ptr<const OrderGroup>& pages) { return isBefore(GetUsername(pages->pages.back()->back())); });
+    if (group == order.end()) {
+        return userCount;
+    }
+
+    const OrderGroup& pages = **group;
+    auto page = std::partition_point(pages.pages.begin(), pages.pages.end(),
+        [this, &isBefore](const std::shared_ptr<const std::vector<UserId>>& ids) { return isBefore(GetUsername(ids->back())); });
+    auto id = std::partition_point((*page)->begin(), (*page)->end(), [this, &isBefore](UserId other) { return isBefore(GetUsername(other)); });
+    return orderStarts[group - order.begin()] + pages.starts[page - pages.pages.begin()] + (id - (*page)->begin());
+}
+
+const Database::Chunk& Database::Version::GetChunk(size_t chunk) const {
+    return *chunks[chunk / kChunkPageSize]->chunks[chunk % kChunkPageSize];
+}
+
+size_t Database::Version::ChunkCount() const {
+    return (userCount + kChunkUsers - 1) / kChunkUsers;
+}
+
+size_t Database::FindPrefix(std::wstring_view prefix, size_t& first) const {
+    ReadSection section;
+    const Version& version = *current.load();
+    first = version.PartitionPoint([prefix](std::wstring_view name) { return name < prefix; });
+    size_t end = version.PartitionPoint([prefix](std::wstring_view name) { return name < prefix || name.starts_with(prefix); });
+    return end - first;
+}
+
+size_t Database::GetUsersInOrder(size_t position, size_t count, UserId* ids) const {
+    ReadSection section;
+    const Version& version = *current.load();
+    size_t written = 0;
+    for (; written < count && position < version.userCount; ++written, ++position) {
+        ids[written] = version.GetUserAt(position);
+    }
+
+    return written;
+}
+
+std::vector<UserId> Database::FindSimilar(std::wstring_view pattern, size_t maxDistance, size_t offset, size_t count, size_t& total) const {
+    ReadSection section;
+    const Version& version = *current.load();
+    // Walks usernames in order like a trie: rows[depth] is the edit distance row for the first depth characters
+    // of the current username, and rows of the prefix shared with the previous username are reused
+    size_t columns = pattern.length() + 1;
+    std::vector<size_t> rows(columns);
+    for (size_t column = 0; column < columns; ++column) {
+        rows[column] = column;
+    }
+
+    std::vector<std::pair<size_t, UserId>> matches;
+    std::wstring_view previous;
+    size_t validRows = 1;
+    size_t position = 0;
+    while (position < version.userCount) {
+        UserId id = version.GetUserAt(position);
+        std::wstring_view username = version.GetUsername(id);
+        size_t depth = 0;
+        while (depth + 1 < validRows && depth < username.length() && username[depth] == previous[depth]) {
+            ++depth;
+        }
+
+        rows.resize((username.length() + 1) * columns);
+        bool isTooFar = false;
+        for (; depth < username.length(); ++depth) {
+            const size_t* row = &rows[depth * columns];
+            size_t* nextRow = &rows[(depth + 1) * columns];
+            nextRow[0] = depth + 1;
+            size_t best = nextRow[0];
+            for (size_t column = 1; column < columns; ++column) {
+                size_t substitution = row[column - 1] + (username[depth] == pattern[column - 1] ? 0 : 1);
+                nextRow[column] = std::min({ row[column] + 1, nextRow[column - 1] + 1, substitution });
+                best = std::min(best, nextRow[column]);
+            }
+
+            // Row minimum never decreases, so no username with this prefix can match
+            if (best > maxDistance) {
+                isTooFar = true;
+                break;
+            }
+        }
+
+        previous = username;
+        if (isTooFar) {
+            validRows = depth + 1;
+            std::wstring_view prefix = username.substr(0, depth + 1);
+            position = std::max(position + 1, version.PartitionPoint([prefix](std::wstring_view name) { return name < prefix || name.starts_with(prefix); }));
+            continue;
+        }
+
+        validRows = username.length() + 1;
+        size_t distance = rows[username.length() * columns + pattern.length()];
+        if (distance <= maxDistance) {
+            matches.emplace_back(distance, id);
+        }
+
+        ++position;
+    }
+
+    std::stable_sort(matches.begin(), matches.end(), [](const auto& left, const auto& right) { return left.first < right.first; });
+    total = matches.size();
+    std::vector<UserId> page;
+    for (size_t i = offset; i < matches.size() && page.size() < count; ++i) {
+        page.push_back(matches[i].second);
+    }
+
+    return page;
+}
+
+UserId Database::Version::Find(std::wstring_view username) const {
+    if (index->empty()) {
+        return kInvalidUser;
     }
 
-    return ifs;
+    const std::vector<std::atomic<uint32_t>>& slots = *index;
+    size_t mask = slots.size() - 1;
+    uint32_t entry;
+    for (size_t slot = HashUsername(username) & mask; (entry = slots[slot].load(std::memory_order_relaxed)) != 0; slot = (slot + 1) & mask) {
+        if (entry <= userCount && GetUsername(entry - 1) == username) {
+            return entry - 1;
+        }
+    }
+
+    return kInvalidUser;
+}
+
+std::wstring_view Database::Version::GetUsername(UserId id) const {
+    return GetChunk(id / kChunkUsers).usernames[id % kChunkUsers];
+}
+
+const PasswordHash& Database::Version::GetPasswordHash(UserId id) const {
+    return GetChunk(id / kChunkUsers).passwords[id % kChunkUsers];
+}
+
+bool Database::Version::IsBlocked(UserId id) const {
+    return IsFlagged(id, AccountFlag::BLOCKED);
+}
+
+bool Database::Version::IsRestrictionEnabled(UserId id) const {
+    return IsFlagged(id, AccountFlag::RESTRICTED);
+}
+
+bool Database::Version::IsFlagged(UserId id, AccountFlag flag) const {
+    return GetChunk(id / kChunkUsers).flags[(size_t)flag].Get(id % kChunkUsers);
+}
+
+Database::StringRef Database::AppendString(std::vector<wchar_t>& pool, std::wstring_view string) {
+    StringRef ref = { (uint32_t)pool.size(), (uint32_t)string.length() };
+    pool.insert(pool.end(), string.begin(), string.end());
+    pool.push_back(L'\0');
+    return ref;
+}
+
+std::wstring_view Database::AppendUsername(std::wstring_view username) {
+    // Never grow a pool past its capacity: reallocation would move usernames readers point to
+    if (usernamePools.empty() || usernamePools.back().capacity() - usernamePools.back().size() <= username.length()) {
+        usernamePools.emplace_back();
+        usernamePools.back().reserve(std::max(kUsernamePoolSize, username.length() + 1));
+    }
+
+    std::vector<wchar_t>& pool = usernamePools.back();
+    StringRef ref = AppendString(pool, username);
+    return std::wstring_view(pool.data() + ref.offset, ref.length);
+}
+
+const Database::Version& Database::Head() const {
+    return next != nullptr ? *next : *current.load();
+}
+
+Database::Version& Database::Edit() {
+    if (next == nullptr) {
+        next = std::make_unique<Version>(*current.load());
+        ownedPages.assign(next->chunks.size(), false);
+        ownedChunks.assign(next->ChunkCount(), false);
+    }
+
+    return *next;
+}
+
+Database::Chunk& Database::EditChunk(UserId id) {
+    Version& version = Edit();
+    size_t chunk = id / kChunkUsers;
+    size_t page = chunk / kChunkPageSize;
+    if (page == version.chunks.size()) {
+        version.chunks.push_back(std::make_shared<ChunkPage>());
+        ownedPages.push_back(true);
+    }
+    else if (!ownedPages[page]) {
+        version.chunks[page] = std::make_shared<ChunkPage>(*version.chunks[page]);
+        ownedPages[page] = true;
+    }
+
+    std::shared_ptr<Chunk>& pointer = version.chunks[page]->chunks[chunk % kChunkPageSize];
+    if (pointer == nullptr) {
+        pointer = std::make_shared<Chunk>();
+        pointer->usernames.reserve(kChunkUsers);
+        pointer->passwords.reserve(kChunkUsers);
+        for (Bitset& flag : pointer->flags) {
+            flag.Resize(kChunkUsers);
+        }
+
+        ownedChunks.resize(std::max(ownedChunks.size(), chunk + 1));
+        ownedChunks[chunk] = true;
+    }
+    else if (!ownedChunks[chunk]) {
+        pointer = std::make_shared<Chunk>(*pointer);
+        ownedChunks[chunk] = true;
+    }
+
+    return *pointer;
+}
+
+void Database::Publish() {
+    if (next == nullptr) {
+        return;
+    }
+
+    const Version* previous = current.exchange(next.release());
+    retired.emplace_back(RetireEpoch(), previous);
+    uint64_t oldest = OldestReadEpoch();
+    size_t kept = 0;
+    for (std::pair<uint64_t, const Version*>& version : retired) {
+        if (version.first < oldest) {
+            delete version.second;
+        }
+        else {
+            retired[kept++] = version;
+        }
+    }
+
+    retired.resize(kept);
+}
+
+bool Database::Replay(const char* data, const char* end) {
+    User record;
+    if ((size_t)(end - data) < sizeof(kJournalMagic) || memcmp(data, kJournalMagic, sizeof(kJournalMagic)) != 0) {
+        bool hasRecords = false;
+        while (data < end) {
+            JournalRecord type = (JournalRecord)*data++;
+            // Torn tail after a crash. Everything before it is valid
+            data = DeserializeLegacy(data, end, record);
+            if (data == nullptr || type > JournalRecord::SET_RESTRICTION) {
+                break;
+            }
+
+            ReplayRecord(record);
+            hasRecords = true;
+        }
+
+        return !hasRecords && data == end;
+    }
+
+    data += sizeof(kJournalMagic) + 1;
+    while (data < end) {
+        const char* start = data++;
+        uint64_t length;
+        uint32_t crc;
+        data = ReadVarint(data, end, length);
+        // Torn or damaged tail after a crash. Everything before it is valid
+        if (data == nullptr || length > (uint64_t)(end - data) || ReadUint32(data + length, end, crc) == nullptr) {
+            return false;
+        }
+
+        const char* recordEnd = data + length;
+        if (Crc32c(data, (size_t)length, Crc32c(start, 1)) != crc || (JournalRecord)*start > JournalRecord::SET_RESTRICTION
+            || Deserialize(data, recordEnd, record) != recordEnd) {
+            return false;
+        }
+
+        ReplayRecord(record);
+        data = recordEnd + sizeof(crc);
+    }
+
+    return true;
+}
+
+void Database::ReplayRecord(const User& record) {
+    ++journalRecords;
+    UserId id = Head().Find(record.username);
+    if (id == kInvalidUser) {
+        id = Insert(record);
+    }
+    else {
+        SetPasswordColumn(id, record);
+        SetFlag(id, AccountFlag::BLOCKED, record.isBlocked);
+        SetFlag(id, AccountFlag::RESTRICTED, record.isRestrictionEnabled);
+    }
+
+    // Journal isn't part of the snapshot yet
+    MarkDirty(id);
+}
+
+void Database::OpenJournal() {
+    if (isCorrupted || isReadOnly) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> fileGuard(journalLock);
+    journal = FileOpen(journalFilename.c_str(), L"ab");
+    if (journal == nullptr) {
+        return;
+    }
+
+    // Fresh journal. Append mode ignores seeks for writes, but reports the size
+    fseek(journal, 0, SEEK_END);
+    if (ftell(journal) == 0) {
+        FileWrite(journal, kJournalMagic, sizeof(kJournalMagic));
+        FileWrite(journal, (const char*)&kFormatVersion, sizeof(kFormatVersion));
+    }
+}
+
+void Database::Append(JournalRecord type, UserId id) {
+    MarkDirty(id);
+    if (journal == nullptr) {
+        OpenJournal();
+        if (journal == nullptr) {
+            return;
+        }
+    }
+
+    std::vector<char> buffer;
+    EncodeRecord(buffer, type, id);
+    Enqueue(buffer, 1);
+    if (++journalRecords >= compactRecords) {
+        Compact();
+    }
+}
+
+void Database::AppendBatch(JournalRecord type, const std::vector<UserId>& ids) {
+    for (UserId id : ids) {
+        MarkDirty(id);
+    }
+
+    if (journal == nullptr) {
+        OpenJournal();
+        if (journal == nullptr) {
+            return;
+        }
+    }
+
+    // Committer gets the records in slices, so a change of every user doesn't build one huge buffer
+    std::vector<char> buffer;
+    size_t records = 0;
+    for (size_t i = 0; i < ids.size(); ++i) {
+        EncodeRecord(buffer, type, ids[i]);
+        ++records;
+        if (i + 1 == ids.size() || buffer.size() >= commitBatchBytes) {
+            Enqueue(buffer, records);
+            journalRecords += records;
+            buffer.clear();
+            records = 0;
+        }
+    }
+}
+
+void Database::EncodeRecord(std::vector<char>& buffer, JournalRecord type, UserId id) {
+    std::vector<char> record;
+    const Version& version = Head();
+    Serialize(record, version.GetUsername(id), version.GetPasswordHash(id), version.IsBlocked(id), version.IsRestrictionEnabled(id));
+    size_t start = buffer.size();
+    buffer.push_back((char)type);
+    WriteVarint(buffer, record.size());
+    buffer.insert(buffer.end(), record.begin(), record.end());
+    WriteUint32(buffer, Crc32c(record.data(), record.size(), Crc32c(buffer.data() + start, 1)));
+}
+
+void Database::Enqueue(const std::vector<char>& buffer, size_t records) {
+    bool isSynchronous;
+    bool isCommitDue;
+    {
+        std::lock_guard<std::mutex> guard(commitLock);
+        // Committer sleeps until the first record of a window and then until it closes
+        isCommitDue = pendingJournal.empty();
+        if (isCommitDue) {
+            pendingSince = std::chrono::steady_clock::now();
+        }
+
+        pendingJournal.insert(pendingJournal.end(), buffer.begin(), buffer.end());
+        appendedRecords += records;
+        isSynchronous = commitLatencyUs == 0;
+        isCommitDue = isCommitDue || pendingJournal.size() >= commitBatchBytes;
+    }
+
+    if (isSynchronous) {
+        CommitJournal();
+    }
+    else if (isCommitDue) {
+        commitRequested.notify_one();
+    }
+}
+
+void Database::CommitJournal() {
+    std::lock_guard<std::mutex> fileGuard(journalLock);
+    uint64_t records;
+    {
+        std::lock_guard<std::mutex> guard(commitLock);
+        committingJournal.clear();
+        committingJournal.swap(pendingJournal);
+        records = appendedRecords;
+    }
+
+    if (!committingJournal.empty() && journal != nullptr) {
+        METRICS_TIME(Timer::JOURNAL_COMMIT);
+        FileWrite(journal, committingJournal.data(), committingJournal.size());
+        FileSync(journal);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(commitLock);
+        durableRecords = std::max(durableRecords, records);
+    }
+
+    committed.notify_all();
+}
+
+void Database::RunCommitter() {
+    std::unique_lock<std::mutex> lock(commitLock);
+    while (true) {
+        commitRequested.wait(lock, [this]() { return isCommitterStopping || !pendingJournal.empty(); });
+        if (pendingJournal.empty()) {
+            return;
+        }
+
+        // Records appended meanwhile join the batch
+        commitRequested.wait_until(lock, pendingSince + std::chrono::microseconds(commitLatencyUs), [this]() {
+            return isCommitterStopping || flushRecords > durableRecords || pendingJournal.size() >= commitBatchBytes;
+        });
+        lock.unlock();
+        CommitJournal();
+        lock.lock();
+    }
+}
+
+void Database::MarkDirty(UserId id) {
+    if (!dirty.Get(id)) {
+        dirty.Set(id, true);
+        ++dirtyUsers;
+    }
+}
+
+void Database::SetPasswordColumn(UserId id, const User& user) {
+    SetPasswordHashColumn(id, user.passwordHash);
+    bool isPlaintext = user.passwordHash.algorithm == KdfAlgorithm::NONE && !user.password.empty();
+    // Empty entry overrides older plaintext of the same user
+    if (isPlaintext || !pendingPasswords.empty()) {
+        pendingPasswords.emplace_back(id, isPlaintext ? user.password : std::wstring());
+    }
+}
+
+void Database::HashPendingPasswords() {
+    if (pendingPasswords.empty()) {
+        return;
+    }
+
+    // Only the latest entry of every user counts
+    std::vector<UserId> ids;
+    std::vector<std::wstring> plaintext;
+    std::unordered_set<UserId> seen;
+    for (auto pending = pendingPasswords.rbegin(); pending != pendingPasswords.rend(); ++pending) {
+        if (seen.insert(pending->first).second && !pending->second.empty()) {
+            ids.push_back(pending->first);
+            plaintext.push_back(std::move(pending->second));
+        }
+    }
+
+    pendingPasswords.clear();
+    std::vector<PasswordHash> hashes = HashBatch(plaintext);
+    for (size_t i = 0; i < hashes.size(); ++i) {
+        SetPasswordHashColumn(ids[i], hashes[i]);
+        MarkDirty(ids[i]);
+    }
+}
+
+UserId Database::Push(const User& user) {
+    Version& version = Edit();
+    UserId id = (UserId)version.userCount++;
+    Chunk& chunk = EditChunk(id);
+    chunk.usernames.push_back(AppendUsername(user.username));
+    chunk.passwords.emplace_back();
+    SetPasswordColumn(id, user);
+    dirty.Resize(id + 1);
+    SetFlag(id, AccountFlag::BLOCKED, user.isBlocked);
+    SetFlag(id, AccountFlag::RESTRICTED, user.isRestrictionEnabled);
+    return id;
+}
+
+void Database::SetPasswordHashColumn(UserId id, const PasswordHash& passwordHash) {
+    EditChunk(id).passwords[id % kChunkUsers] = passwordHash;
+    SetFlag(id, AccountFlag::NO_PASSWORD, passwordHash.algorithm == KdfAlgorithm::NONE);
+}
+
+bool Database::SetFlag(UserId id, AccountFlag flag, bool value) {
+    if (Head().IsFlagged(id, flag) == value) {
+        return false;
+    }
+
+    Chunk& chunk = EditChunk(id);
+    chunk.flags[(size_t)flag].Set(id % kChunkUsers, value);
+    chunk.flagCounts[(size_t)flag] += value ? 1 : -1;
+    Edit().flagCounts[(size_t)flag] += value ? 1 : -1;
+    return true;
+}
+
+size_t Database::SetFlagWhere(AccountFlag flag, AccountFlag target, bool value) {
+    std::lock_guard<std::mutex> guard(writeLock);
+    // Collect first, setting bits copies chunks the walk reads
+    std::vector<UserId> ids;
+    Head().ForEachFlagged(flag, 0, [&ids](UserId id) {
+        ids.push_back(id);
+        return true;
+    });
+
+    std::vector<UserId> changed;
+    for (UserId id : ids) {
+        if (SetFlag(id, target, value)) {
+            changed.push_back(id);
+        }
+    }
+
+    if (changed.empty()) {
+        ++writesSkipped;
+        return 0;
+    }
+
+    Publish();
+    AppendBatch(target == AccountFlag::BLOCKED ? JournalRecord::SET_BLOCKED : JournalRecord::SET_RESTRICTION, changed);
+    return changed.size();
+}
+
+UserId Database::Insert(const User& user) {
+    UserId id = Push(user);
+    IndexUser(id);
+    InsertOrder(id);
+    return id;
+}
+
+void Database::IndexUser(UserId id) {
+    // Keep load factor under 1/2
+    if ((Head().userCount << 1) > Head().index->size()) {
+        RebuildIndex();
+    }
+    else {
+        InsertIndex(id);
+    }
+}
+
+void Database::RebuildIndex() {
+    Version& version = Edit();
+    size_t capacity = 16;
+    while (capacity < (version.userCount << 1)) {
+        capacity <<= 1;
+    }
+
+    // New table. Readers of older versions keep using the old one
+    version.index = std::make_shared<std::vector<std::atomic<uint32_t>>>(capacity);
+    for (UserId id = 0; id < version.userCount; ++id) {
+        InsertIndex(id);
+    }
+}
+
+void Database::InsertIndex(UserId id) {
+    const Version& version = Head();
+    std::vector<std::atomic<uint32_t>>& index = *version.index;
+    size_t mask = index.size() - 1;
+    size_t slot = HashUsername(version.GetUsername(id)) & mask;
+    while (index[slot].load(std::memory_order_relaxed) != 0) {
+        slot = (slot + 1) & mask;
+    }
+
+    index[slot].store(id + 1, std::memory_order_relaxed);
+}
+
+void Database::InsertOrder(UserId id) {
+    Version& version = Edit();
+    std::wstring_view username = version.GetUsername(id);
+    if (version.order.empty()) {
+        SetOrder({ id });
+        return;
+    }
+
+    // Last group, then last page in it, whose first username isn't greater
+    auto afterGroup = std::upper_bound(version.order.begin() + 1, version.order.end(), username,
+        [&version](std::wstring_view name, const std::shared_ptr<const OrderGroup>& group) { return name < version.GetUsername(group->pages.front()->front()); });
+    size_t groupIndex = afterGroup - version.order.begin() - 1;
+    auto group = std::make_shared<OrderGroup>(*version.order[groupIndex]);
+    auto afterPage = std::upper_bound(group->pages.begin() + 1, group->pages.end(), username,
+        [&version](std::wstring_view name, const std::shared_ptr<const std::vector<UserId>>& page) { return name < version.GetUsername(page->front()); });
+    size_t page = afterPage - group->pages.begin() - 1;
+    auto ids = std::make_shared<std::vector<UserId>>(*group->pages[page]);
+    auto position = std::upper_bound(ids->begin(), ids->end(), username,
+        [&version](std::wstring_view name, UserId other) { return name < version.GetUsername(other); });
+    ids->insert(position, id);
+    if (ids->size() > kOrderPageSize) {
+        size_t half = ids->size() / 2;
+        group->pages.insert(group->pages.begin() + page + 1, std::make_shared<const std::vector<UserId>>(ids->begin() + half, ids->end()));
+        ids->resize(half);
+    }
+
+    group->pages[page] = std::move(ids);
+    if (group->pages.size() > 2 * kOrderGroupSize) {
+        size_t half = group->pages.size() / 2;
+        auto second = std::make_shared<OrderGroup>();
+        second->pages.assign(group->pages.begin() + half, group->pages.end());
+        second->UpdateStarts();
+        group->pages.resize(half);
+        version.order.insert(version.order.begin() + groupIndex + 1, std::move(second));
+    }
+
+    group->UpdateStarts();
+    version.order[groupIndex] = std::move(group);
+    UpdateOrderStarts();
+}
+
+void Database::MergeOrder(std::vector<UserId> ids) {
+    Version& version = Edit();
+    auto isLess = [&version](UserId left, UserId right) { return version.GetUsername(left) < version.GetUsername(right); };
+    std::sort(ids.begin(), ids.end(), isLess);
+    std::vector<std::shared_ptr<const std::vector<UserId>>> pages;
+    for (const std::shared_ptr<const OrderGroup>& group : version.order) {
+        pages.insert(pages.end(), group->pages.begin(), group->pages.end());
+    }
+
+    // Pages without new ids are kept as is, the rest are merged and split again
+    std::vector<std::shared_ptr<const std::vector<UserId>>> order;
+    order.reserve(pages.size() + ids.size() / kOrderPageSize + 1);
+    auto added = ids.begin();
+    for (size_t page = 0; page < pages.size(); ++page) {
+        // New ids before the first username of the next page go here
+        auto end = page + 1 < pages.size() ? std::lower_bound(added, ids.end(), pages[page + 1]->front(), isLess) : ids.end();
+        if (end == added) {
+            order.push_back(pages[page]);
+            continue;
+        }
+
+        const std::vector<UserId>& old = *pages[page];
+        std::vector<UserId> merged(old.size() + (end - added));
+        std::merge(old.begin(), old.end(), added, end, merged.begin(), isLess);
+        AppendPages(order, merged);
+        added = end;
+    }
+
+    if (pages.empty()) {
+        AppendPages(order, ids);
+    }
+
+    SetOrderPages(order);
+}
+
+void Database::RebuildOrder() {
+    const Version& version = Head();
+    std::vector<UserId> ids(version.userCount);
+    for (UserId id = 0; id < ids.size(); ++id) {
+        ids[id] = id;
+    }
+
+    std::sort(ids.begin(), ids.end(), [&version](UserId left, UserId right) { return version.GetUsername(left) < version.GetUsername(right); });
+    SetOrder(ids);
+}
+
+void Database::SetOrder(const std::vector<UserId>& ids) {
+    std::vector<std::shared_ptr<const std::vector<UserId>>> pages;
+    AppendPages(pages, ids);
+    SetOrderPages(pages);
+}
+
+void Database::SetOrderPages(const std::vector<std::shared_ptr<const std::vector<UserId>>>& pages) {
+    Version& version = Edit();
+    version.order.clear();
+    for (size_t first = 0; first < pages.size(); first += kOrderGroupSize) {
+        auto group = std::make_shared<OrderGroup>();
+        group->pages.assign(pages.begin() + first, pages.begin() + std::min(first + kOrderGroupSize, pages.size()));
+        group->UpdateStarts();
+        version.order.push_back(std::move(group));
+    }
+
+    UpdateOrderStarts();
+}
+
+void Database::UpdateOrderStarts() {
+    Version& version = Edit();
+    version.orderStarts.resize(version.order.size());
+    size_t position = 0;
+    for (size_t group = 0; group < version.order.size(); ++group) {
+        version.orderStarts[group] = position;
+        position += version.order[group]->userCount;
+    }
+}
+
+void Database::OrderGroup::UpdateStarts() {
+    starts.resize(pages.size());
+    userCount = 0;
+    for (size_t page = 0; page < pages.size(); ++page) {
+        starts[page] = userCount;
+        userCount += pages[page]->size();
+    }
 }
@@ -2,18 +2,317 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
+#include <cstdio>
+#include <cstdint>
 
 #include "User.h"
+#include "UserStore.h"
+#include "PasswordHasher.h"
+#include "Bitset.h"
 
-struct Database {
-    Database(const wchar_t* filename);
+// users.dat v2: [magic][version], then blocks of [recordCount][payloadLength][payload][crc32c of payload].
+// Counts and lengths are varints. Legacy files have no header and start with the user count
+constexpr char kSnapshotMagic[4] = { 'P', 'R', '2', 'D' };
+// Journal v2: [magic][version], then records of [type][payloadLength][user record][crc32c of type and user record]
+constexpr char kJournalMagic[4] = { 'P', 'R', '2', 'J' };
+constexpr uint8_t kFormatVersion = 2;
+constexpr size_t kBlockRecords = 4096;
+// Snapshot is written in pieces of about this size instead of one image of the whole file
+constexpr size_t kSnapshotWriteSize = 1 << 20;
+// Snapshots with fewer blocks are decoded on the calling thread
+constexpr size_t kParallelLoadBlocks = 4;
 
-    void Save() const;
+// Every mutation is appended to the journal with the full state of the user,
+// so replaying a record twice gives the same result
+enum class JournalRecord : uint8_t {
+    ADD,
+    SET_PASSWORD,
+    SET_BLOCKED,
+    SET_RESTRICTION
+};
+
+// Account states with a bitmap index
+enum class AccountFlag : uint8_t {
+    BLOCKED,
+    RESTRICTED,
+    NO_PASSWORD
+};
+
+constexpr size_t kAccountFlags = 3;
+
+// Journal is compacted into the snapshot after that many records
+constexpr size_t kJournalCompactThreshold = 1024;
+// Journal records are written and synced in one batch at most this long after the first of them
+constexpr uint32_t kCommitLatencyUs = 2000;
+// Batch is committed right away once it has that many bytes
+constexpr size_t kCommitBatchBytes = 1 << 16;
+// Users per chunk. A write copies one chunk instead of the whole column
+constexpr size_t kChunkUsers = 256;
+// Chunks per page of the chunk table. A write copies the page table and one page, not a pointer per chunk
+constexpr size_t kChunkPageSize = 256;
+// Usernames are appended to pools of this size and never move
+constexpr size_t kUsernamePoolSize = 65536;
+// Ids per page of username order. A page is split in half when it grows past this
+constexpr size_t kOrderPageSize = 512;
+// Pages per group of username order. A group is split in half when it grows past twice this
+constexpr size_t kOrderGroupSize = 64;
 
-    friend std::ofstream& operator<<(std::ofstream& ofs, const Database& database);
-    friend std::ifstream& operator>>(std::ifstream& ifs, Database& database);
+// Users are stored column-wise: strings live in shared pools and flags in bitsets,
+// so a scan over all users reads a few contiguous arrays.
+// Reads are lock-free and may run on any thread: they see the last published version and never wait for writers.
+// Writes are serialized by a mutex, copy only the chunks they change and publish a new version atomically
+struct Database final : UserStore {
+    // Creates the admin user if it's missing, unless withAdmin is false. Read-only database never writes to disk,
+    // not even to fold a legacy file or a torn journal, its mutations only change memory
+    Database(const wchar_t* filename, bool withAdmin = true, bool isReadOnly = false);
+    Database(const Database& other) = delete;
+    ~Database();
+
+    // Writes snapshot and clears journal. Does nothing if no user changed since the last snapshot.
+    // Snapshot goes to a temporary file that is renamed over the old one, so a crash never leaves a torn snapshot.
+    // Returns false if it couldn't be written, changes stay in the journal. Read-only database has nothing to write
+    bool Save();
+    // Mutations return once they are visible. Their journal records are written by a background thread that
+    // coalesces everything pending into one write and sync per commit window.
+    // Waits until every mutation made before the call is on disk
+    void Flush() override;
+    // Window closes latencyUs after its first record or once it has batchBytes. Zero latency syncs every mutation before it returns
+    void SetCommitWindow(uint32_t latencyUs, size_t batchBytes);
+    // Replaces users with records parsed from a file image. Returns false and keeps the users if the image is truncated or damaged.
+    // Blocks are decoded on threadCount threads, 0 means one per core
+    bool Load(const char* data, const char* end, size_t threadCount = 0);
+    // Returns kInvalidUser if user doesn't exist
+    UserId Find(std::wstring_view username) const override;
+    // Returns kInvalidUser if user with such name already exists, the name fails IsValidUnicode or there are maxUsers users
+    UserId AddUser(const User& user) override;
+    // Adds users in one version and hashes their passwords on all cores. Id is kInvalidUser for every user AddUser would refuse
+    std::vector<UserId> AddUsers(const std::vector<User>& users);
+    // Hashes password with default KDF parameters. Empty password resets it
+    void SetPassword(UserId id, std::wstring_view password) override;
+    bool SetInitialPassword(UserId id, std::wstring_view password) override;
+    void SetPasswordHash(UserId id, const PasswordHash& passwordHash);
+    void SetBlocked(UserId id, bool isBlocked) override;
+    void SetRestrictionEnabled(UserId id, bool isRestrictionEnabled) override;
+
+    size_t UserCount() const;
+    // View is null-terminated
+    std::wstring_view GetUsername(UserId id) const override;
+    PasswordHash GetPasswordHash(UserId id) const;
+    bool HasPassword(UserId id) const override;
+    bool VerifyPassword(UserId id, std::wstring_view password) const override;
+    bool IsBlocked(UserId id) const override;
+    bool IsRestrictionEnabled(UserId id) const override;
+    // Changed since the last snapshot. Takes the writer lock
+    bool IsDirty(UserId id) const;
+
+    // Username order is ordinal, by wchar_t values. Positions in it shift when users are added.
+    // Returns number of usernames starting with prefix, first is position of the first one
+    size_t FindPrefix(std::wstring_view prefix, size_t& first) const;
+    // Writes ids at positions [position, position + count) of username order. Returns number written
+    size_t GetUsersInOrder(size_t position, size_t count, UserId* ids) const;
+    // Usernames within maxDistance edits (Levenshtein) of pattern, closest first and then in username order.
+    // Returns matches [offset, offset + count), total gets number of all matches
+    std::vector<UserId> FindSimilar(std::wstring_view pattern, size_t maxDistance, size_t offset, size_t count, size_t& total) const;
+
+    // Flag queries read bitmaps kept up to date by every mutation and skip chunks without the flag
+    size_t CountFlagged(AccountFlag flag) const;
+    // Writes up to count ids with flag in id order, starting from id from. Returns number written, next page starts after the last id
+    size_t GetFlagged(AccountFlag flag, UserId from, size_t count, UserId* ids) const;
+    // Changes every user with flag in one version, journaled like single changes. Returns number of users changed
+    size_t SetBlockedWhere(AccountFlag flag, bool isBlocked);
+    size_t SetRestrictionEnabledWhere(AccountFlag flag, bool isRestrictionEnabled);
 
-    std::vector<std::unique_ptr<User>> users;
     const wchar_t* filename;
+    // Snapshot failed validation on open. Database is left unusable and never writes to disk, so the file can be restored
+    bool isCorrupted;
+    bool isReadOnly;
+    // Ids stay below kInvalidUser. ShardedDatabase lowers it, so global ids of its shards do too. Set before adding users
+    size_t maxUsers;
+    // Counters are updated under the writer lock
+    size_t dirtyUsers;
+    size_t savesWritten;
+    size_t savesSkipped;
+    // Snapshots that couldn't be written
+    size_t savesFailed;
+    // Mutations that didn't change anything and weren't journaled
+    size_t writesSkipped;
+
+private:
+    // Location of a string in a pool, without the terminating zero
+    struct StringRef {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    // Users [n * kChunkUsers, (n + 1) * kChunkUsers). Shared by versions until a writer changes one of them
+    struct Chunk {
+        // Point into username pools
+        std::vector<std::wstring_view> usernames;
+        std::vector<PasswordHash> passwords;
+        // Indexed by AccountFlag
+        Bitset flags[kAccountFlags];
+        uint32_t flagCounts[kAccountFlags];
+    };
+
+    // Chunks [n * kChunkPageSize, (n + 1) * kChunkPageSize), null past the last one. Shared like chunks
+    struct ChunkPage {
+        std::shared_ptr<Chunk> chunks[kChunkPageSize];
+    };
+
+    // Consecutive pages of username order. Shared by versions until an insert lands in one of its pages
+    struct OrderGroup {
+        void UpdateStarts();
+
+        std::vector<std::shared_ptr<const std::vector<UserId>>> pages;
+        // Position of the first id of every page within the group
+        std::vector<size_t> starts;
+        size_t userCount = 0;
+    };
+
+    // Immutable once published
+    struct Version {
+        UserId Find(std::wstring_view username) const;
+        std::wstring_view GetUsername(UserId id) const;
+        const PasswordHash& GetPasswordHash(UserId id) const;
+        bool IsBlocked(UserId id) const;
+        bool IsRestrictionEnabled(UserId id) const;
+        bool IsFlagged(UserId id, AccountFlag flag) const;
+        // Calls callback with ids having flag, from id from, until it returns false
+        template<typename Callback>
+        void ForEachFlagged(AccountFlag flag, UserId from, Callback callback) const;
+        UserId GetUserAt(size_t position) const;
+        // First position whose username doesn't satisfy isBefore. Usernames satisfying it must come first
+        template<typename Predicate>
+        size_t PartitionPoint(Predicate isBefore) const;
+        const Chunk& GetChunk(size_t chunk) const;
+        size_t ChunkCount() const;
+
+        // Two levels, so a new version copies one pointer per page and not per chunk
+        std::vector<std::shared_ptr<ChunkPage>> chunks;
+        // Open addressing (linear probing) username -> id, keyed SipHash. Slot stores id + 1, 0 - empty.
+        // Shared between versions: writers only fill empty slots, readers skip ids newer than their version
+        std::shared_ptr<std::vector<std::atomic<uint32_t>>> index = std::make_shared<std::vector<std::atomic<uint32_t>>>();
+        size_t userCount = 0;
+        // Ids sorted by username, in pages of groups. Writers copy one group and one page per insert
+        std::vector<std::shared_ptr<const OrderGroup>> order;
+        // Position of the first id of every group
+        std::vector<size_t> orderStarts;
+        size_t flagCounts[kAccountFlags] = {};
+    };
+
+    // Users of one snapshot block, decoded on a loader thread independently of others
+    struct Block {
+        const char* data;
+        const char* end;
+        uint64_t count;
+        uint32_t crc;
+        bool isValid;
+        std::vector<wchar_t> usernamePool;
+        std::vector<StringRef> usernames;
+        std::vector<PasswordHash> passwords;
+        std::vector<uint8_t> flags;
+        // Records from before hashing, by position in block
+        std::vector<std::pair<size_t, std::wstring>> plaintext;
+    };
+
+    static StringRef AppendString(std::vector<wchar_t>& pool, std::wstring_view string);
+    // Copies username into a pool that outlives every version
+    std::wstring_view AppendUsername(std::wstring_view username);
+    // Latest state including unpublished edits. Writer only
+    const Version& Head() const;
+    // Version being built, copied from the published one on first use
+    Version& Edit();
+    // Chunk of id in the version being built. Cloned on first change, so published versions stay intact
+    Chunk& EditChunk(UserId id);
+    // Makes edits visible to readers and frees versions nobody reads anymore
+    void Publish();
+    // Writes snapshot and starts a new journal. After a failure the next automatic try waits for another
+    // kJournalCompactThreshold records, so a full disk doesn't rewrite the snapshot on every mutation
+    bool Compact();
+    bool LoadBlocks(const char* data, const char* end, size_t threadCount);
+    static void DecodeBlock(Block& block);
+    bool LoadLegacy(const char* data, const char* end);
+    // Returns false if journal is in the legacy format or has a torn tail, so it can't be appended to
+    bool Replay(const char* data, const char* end);
+    void ReplayRecord(const User& record);
+    void OpenJournal();
+    void Append(JournalRecord type, UserId id);
+    // Journals every user of a bulk change. Never compacts midway, the next single mutation or Save does
+    void AppendBatch(JournalRecord type, const std::vector<UserId>& ids);
+    void EncodeRecord(std::vector<char>& buffer, JournalRecord type, UserId id);
+    // Hands encoded records to the committer, or commits them at once with zero latency
+    void Enqueue(const std::vector<char>& buffer, size_t records);
+    // Writes and syncs pending journal records, batches go to the file in append order
+    void CommitJournal();
+    void RunCommitter();
+    void MarkDirty(UserId id);
+    void SetPasswordColumn(UserId id, const User& user);
+    // Column writes keeping the flag bitmaps and counts in sync
+    void SetPasswordHashColumn(UserId id, const PasswordHash& passwordHash);
+    // Returns false if flag already had this value
+    bool SetFlag(UserId id, AccountFlag flag, bool value);
+    size_t SetFlagWhere(AccountFlag flag, AccountFlag target, bool value);
+    // Hashes plaintext passwords from old files on all cores
+    void HashPendingPasswords();
+    // Appends user to columns without updating the index
+    UserId Push(const User& user);
+    UserId Insert(const User& user);
+    // Adds pushed user to the hash index
+    void IndexUser(UserId id);
+    void RebuildIndex();
+    void InsertIndex(UserId id);
+    void InsertOrder(UserId id);
+    // Adds many pushed users to username order at once
+    void MergeOrder(std::vector<UserId> ids);
+    void RebuildOrder();
+    // Replaces username order with sorted ids split into pages
+    void SetOrder(const std::vector<UserId>& ids);
+    // Replaces username order with pages, kOrderGroupSize per group
+    void SetOrderPages(const std::vector<std::shared_ptr<const std::vector<UserId>>>& pages);
+    void UpdateOrderStarts();
+
+    std::atomic<const Version*> current;
+    std::unique_ptr<Version> next;
+    // Pages and chunks the version being built has its own copies of
+    std::vector<bool> ownedPages;
+    std::vector<bool> ownedChunks;
+    // Replaced versions with their retire epochs
+    std::vector<std::pair<uint64_t, const Version*>> retired;
+    mutable std::mutex writeLock;
+    // Readers may hold views into any of them, so they are only freed with the database
+    std::vector<std::vector<wchar_t>> usernamePools;
+    std::vector<std::pair<UserId, std::wstring>> pendingPasswords;
+    Bitset dirty;
+    std::wstring journalFilename;
+    FILE* journal;
+    size_t journalRecords;
+    // Append compacts once journalRecords reaches it
+    size_t compactRecords;
+    // Serializes writes to the journal file. Taken after writeLock
+    std::mutex journalLock;
+    // Guards the fields below. Taken after journalLock
+    std::mutex commitLock;
+    std::condition_variable commitRequested;
+    std::condition_variable committed;
+    // Records appended but not written yet
+    std::vector<char> pendingJournal;
+    // Batch being written. Swapped with pendingJournal, so both keep their capacity
+    std::vector<char> committingJournal;
+    std::chrono::steady_clock::time_point pendingSince;
+    // Records are numbered in append order
+    uint64_t appendedRecords;
+    uint64_t durableRecords;
+    // Flush waits for this record
+    uint64_t flushRecords;
+    uint32_t commitLatencyUs;
+    size_t commitBatchBytes;
+    bool isCommitterStopping;
+    std::thread committer;
 };
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <memory_resource>
+
+// Stack arena for the text of one dialog request. Longer input spills to the heap
+constexpr size_t kDialogArenaSize = 2048;
+
+// Text of a dialog control, allocated from arena
+inline std::pmr::wstring GetDialogText(HWND hwnd, int id, std::pmr::memory_resource& arena) {
+    std::pmr::wstring text(&arena);
+    text.resize(GetWindowTextLengthW(GetDlgItem(hwnd, id)));
+    GetDlgItemTextW(hwnd, id, text.data(), (int)text.length() + 1);
+    return text;
+}
@@ -0,0 +1,269 @@
+#include <array>
+#include <cstring>
+
+#include "Encoding.h"
+
+namespace {
+    // Slicing-by-8 tables, reflected polynomial 0x82F63B78
+    std::array<std::array<uint32_t, 256>, 8> MakeCrcTables() {
+        std::array<std::array<uint32_t, 256>, 8> tables = {};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1)));
+            }
+
+            tables[0][i] = crc;
+        }
+
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (size_t table = 1; table < 8; ++table) {
+                tables[table][i] = (tables[table - 1][i] >> 8) ^ tables[0][tables[table - 1][i] & 0xFF];
+            }
+        }
+
+        return tables;
+    }
+
+    const std::array<std::array<uint32_t, 256>, 8> kCrcTables = MakeCrcTables();
+
+    template<typename Buffer>
+    void PushUtf8(Buffer& buffer, uint32_t codePoint) {
+        if (codePoint < 0x80) {
+            buffer.push_back((char)codePoint);
+        }
+        else if (codePoint < 0x800) {
+            buffer.push_back((char)(0xC0 | (codePoint >> 6)));
+            buffer.push_back((char)(0x80 | (codePoint & 0x3F)));
+        }
+        else if (codePoint < 0x10000) {
+            buffer.push_back((char)(0xE0 | (codePoint >> 12)));
+            buffer.push_back((char)(0x80 | ((codePoint >> 6) & 0x3F)));
+            buffer.push_back((char)(0x80 | (codePoint & 0x3F)));
+        }
+        else {
+            buffer.push_back((char)(0xF0 | (codePoint >> 18)));
+            buffer.push_back((char)(0x80 | ((codePoint >> 12) & 0x3F)));
+            buffer.push_back((char)(0x80 | ((codePoint >> 6) & 0x3F)));
+            buffer.push_back((char)(0x80 | (codePoint & 0x3F)));
+        }
+    }
+}
+
+uint32_t Crc32c(const char* data, size_t size, uint32_t crc) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    crc = ~crc;
+    while (size >= 8) {
+        uint32_t low;
+        uint32_t high;
+        memcpy(&low, bytes, sizeof(low));
+        memcpy(&high, bytes + 4, sizeof(high));
+        low ^= crc;
+        crc = kCrcTables[7][low & 0xFF] ^ kCrcTables[6][(low >> 8) & 0xFF] ^ kCrcTables[5][(low >> 16) & 0xFF] ^ kCrcTables[4][low >> 24]
+            ^ kCrcTables[3][high & 0xFF] ^ kCrcTables[2][(high >> 8) & 0xFF] ^ kCrcTables[1][(high >> 16) & 0xFF] ^ kCrcTables[0][high >> 24];
+        bytes += 8;
+        size -= 8;
+    }
+
+    while (size-- > 0) {
+        crc = (crc >> 8) ^ kCrcTables[0][(crc ^ *bytes++) & 0xFF];
+    }
+
+    return ~crc;
+}
+
+void WriteUint32(std::vector<char>& buffer, uint32_t value) {
+    // Little-endian regardless of the host
+    for (int i = 0; i < 4; ++i) {
+        buffer.push_back((char)(value >> (8 * i)));
+    }
+}
+
+const char* ReadUint32(const char* data, const char* end, uint32_t& value) {
+    if (end - data < 4) {
+        return nullptr;
+    }
+
+    value = 0;
+    for (int i = 0; i < 4; ++i) {
+        value |= (uint32_t)(unsigned char)data[i] << (8 * i);
+    }
+
+    return data + 4;
+}
+
+void WriteVarint(std::vector<char>& buffer, uint64_t value) {
+    while (value >= 0x80) {
+        buffer.push_back((char)(value | 0x80));
+        value >>= 7;
+    }
+
+    buffer.push_back((char)value);
+}
+
+const char* ReadVarint(const char* data, const char* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && data < end; shift += 7) {
+        unsigned char byte = (unsigned char)*data++;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return data;
+        }
+    }
+
+    return nullptr;
+}
+
+bool IsValidUnicode(std::wstring_view string) {
+    for (size_t i = 0; i < string.length(); ++i) {
+        uint32_t codePoint = (uint32_t)string[i];
+        if (codePoint >= 0xD800 && codePoint <= 0xDBFF && sizeof(wchar_t) == 2 && i + 1 < string.length()
+            && (uint32_t)string[i + 1] >= 0xDC00 && (uint32_t)string[i + 1] <= 0xDFFF) {
+            ++i;
+            continue;
+        }
+
+        if ((codePoint >= 0xD800 && codePoint <= 0xDFFF) || codePoint > 0x10FFFF) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+size_t Utf8Length(std::wstring_view string) {
+    size_t length = 0;
+    for (size_t i = 0; i < string.length(); ++i) {
+        uint32_t codePoint = (uint32_t)string[i];
+        if (codePoint < 0x80) {
+            length += 1;
+        }
+        else if (codePoint < 0x800) {
+            length += 2;
+        }
+        else if (sizeof(wchar_t) == 2 && codePoint >= 0xD800 && codePoint <= 0xDBFF && i + 1 < string.length()
+            && (uint32_t)string[i + 1] >= 0xDC00 && (uint32_t)string[i + 1] <= 0xDFFF) {
+            length += 4;
+            ++i;
+        }
+        else if (codePoint < 0x10000 || codePoint > 0x10FFFF) {
+            length += 3;
+        }
+        else {
+            length += 4;
+        }
+    }
+
+    return length;
+}
+
+namespace {
+    template<typename Buffer>
+    void AppendUtf8(Buffer& buffer, std::wstring_view string) {
+        for (size_t i = 0; i < string.length(); ++i) {
+            uint32_t codePoint = (uint32_t)string[i];
+            // Join UTF-16 surrogate pair. Lone surrogates are stored as is, ReadUtf8 takes them back
+            if (codePoint > 0x10FFFF) {
+                codePoint = 0xFFFD;
+            }
+            else if (sizeof(wchar_t) == 2 && codePoint >= 0xD800 && codePoint <= 0xDBFF && i + 1 < string.length()) {
+                uint32_t low = (uint32_t)string[i + 1];
+                if (low >= 0xDC00 && low <= 0xDFFF) {
+                    codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+                    ++i;
+                }
+            }
+
+            PushUtf8(buffer, codePoint);
+        }
+    }
+}
+
+int HexDigit(char ch) {
+    if (ch >= '0' && ch <= '9') {
+        return ch - '0';
+    }
+
+    if (ch >= 'a' && ch <= 'f') {
+        return ch - 'a' + 10;
+    }
+
+    if (ch >= 'A' && ch <= 'F') {
+        return ch - 'A' + 10;
+    }
+
+    return -1;
+}
+
+void WriteUtf8(std::vector<char>& buffer, std::wstring_view string) {
+    AppendUtf8(buffer, string);
+}
+
+void WriteUtf8(std::pmr::string& buffer, std::wstring_view string) {
+    AppendUtf8(buffer, string);
+}
+
+bool ReadUtf8(const char* data, size_t size, std::wstring& string) {
+    string.clear();
+    string.reserve(size);
+    const unsigned char* bytes = (const unsigned char*)data;
+    const unsigned char* end = bytes + size;
+    while (bytes < end) {
+        uint32_t codePoint = *bytes++;
+        if (codePoint < 0x80) {
+            string.push_back((wchar_t)codePoint);
+            continue;
+        }
+
+        int continuation;
+        if ((codePoint & 0xE0) == 0xC0) {
+            codePoint &= 0x1F;
+            continuation = 1;
+        }
+        else if ((codePoint & 0xF0) == 0xE0) {
+            codePoint &= 0x0F;
+            continuation = 2;
+        }
+        else if ((codePoint & 0xF8) == 0xF0) {
+            codePoint &= 0x07;
+            continuation = 3;
+        }
+        else {
+            return false;
+        }
+
+        if (end - bytes < continuation) {
+            return false;
+        }
+
+        for (int i = 0; i < continuation; ++i) {
+            if ((bytes[i] & 0xC0) != 0x80) {
+                return false;
+            }
+
+            codePoint = (codePoint << 6) | (bytes[i] & 0x3F);
+        }
+
+        bytes += continuation;
+        // Shortest form only, so every string has one encoding
+        static constexpr uint32_t kMinCodePoint[] = { 0, 0x80, 0x800, 0x10000 };
+        if (codePoint > 0x10FFFF || codePoint < kMinCodePoint[continuation]) {
+            return false;
+        }
+
+        if (sizeof(wchar_t) == 2 && codePoint >= 0x10000) {
+            codePoint -= 0x10000;
+            string.push_back((wchar_t)(0xD800 + (codePoint >> 10)));
+            string.push_back((wchar_t)(0xDC00 + (codePoint & 0x3FF)));
+        }
+        else {
+            string.push_back((wchar_t)codePoint);
+        }
+    }
+
+    return true;
+}
+
+void WriteCodePoint(std::string& buffer, uint32_t codePoint) {
+    PushUtf8(buffer, codePoint);
+}
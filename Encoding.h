@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <memory_resource>
+#include <cstdint>
+
+// CRC-32C (Castagnoli). Pass previous result as crc to continue a running checksum
+uint32_t Crc32c(const char* data, size_t size, uint32_t crc = 0);
+
+void WriteUint32(std::vector<char>& buffer, uint32_t value);
+const char* ReadUint32(const char* data, const char* end, uint32_t& value);
+// LEB128. Reads return nullptr if data is truncated or malformed
+void WriteVarint(std::vector<char>& buffer, uint64_t value);
+const char* ReadVarint(const char* data, const char* end, uint64_t& value);
+// Value of a hex digit in either case, -1 if ch isn't one
+int HexDigit(char ch);
+// False on lone surrogates and on values past U+10FFFF, which aren't characters. Usernames have to pass it
+bool IsValidUnicode(std::wstring_view string);
+// Number of bytes WriteUtf8 produces
+size_t Utf8Length(std::wstring_view string);
+// UTF-8 from/to UTF-16 (Windows) or UTF-32 wchar_t. Values past U+10FFFF are written as U+FFFD, so ReadUtf8 takes
+// back everything WriteUtf8 writes. Reading refuses overlong and truncated sequences
+void WriteUtf8(std::vector<char>& buffer, std::wstring_view string);
+// Appends to a string from an arena, so short-lived copies don't touch the heap
+void WriteUtf8(std::pmr::string& buffer, std::wstring_view string);
+bool ReadUtf8(const char* data, size_t size, std::wstring& string);
+// Appends one code point, which has to be at most U+10FFFF
+void WriteCodePoint(std::string& buffer, uint32_t codePoint);
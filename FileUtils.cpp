@@ -0,0 +1,93 @@
+#ifdef _WIN32
+#include <Windows.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <filesystem>
+#include <string>
+#endif
+
+#include "FileUtils.h"
+
+#ifdef _WIN32
+#define FileSeek _fseeki64
+#define FileTell _ftelli64
+#else
+#define FileSeek fseeko
+#define FileTell ftello
+#endif
+
+FILE* FileOpen(const wchar_t* filename, const wchar_t* mode) {
+#ifdef _WIN32
+    return _wfopen(filename, mode);
+#else
+    std::string narrowMode;
+    for (const wchar_t* ch = mode; *ch != L'\0'; ++ch) {
+        narrowMode.push_back((char)*ch);
+    }
+
+    return fopen(std::filesystem::path(filename).c_str(), narrowMode.c_str());
+#endif
+}
+
+bool FileReadAll(const wchar_t* filename, std::vector<char>& buffer) {
+    FILE* file = FileOpen(filename, L"rb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    buffer.clear();
+    if (FileSeek(file, 0, SEEK_END) == 0) {
+        long long length = FileTell(file);
+        if (length > 0) {
+            buffer.resize((size_t)length);
+        }
+
+        FileSeek(file, 0, SEEK_SET);
+    }
+
+    buffer.resize(fread(buffer.data(), 1, buffer.size(), file));
+    fclose(file);
+    return true;
+}
+
+bool FileWrite(FILE* file, const char* data, size_t size) {
+    return fwrite(data, 1, size, file) == size;
+}
+
+bool FileSync(FILE* file) {
+    if (fflush(file) != 0) {
+        return false;
+    }
+
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+bool FileReplace(const wchar_t* from, const wchar_t* to) {
+#ifdef _WIN32
+    return MoveFileExW(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    std::filesystem::path target(to);
+    std::error_code error;
+    std::filesystem::rename(std::filesystem::path(from), target, error);
+    if (error) {
+        return false;
+    }
+
+    // Rename lives in the directory entry
+    std::filesystem::path directory = target.parent_path();
+    int fd = open(directory.empty() ? "." : directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+
+    bool isSynced = fsync(fd) == 0;
+    close(fd);
+    return isSynced;
+#endif
+}
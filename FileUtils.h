@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdio>
+#include <vector>
+
+// Same as _wfopen, available on every platform
+FILE* FileOpen(const wchar_t* filename, const wchar_t* mode);
+// Reads the whole file. Returns false if file can't be opened
+bool FileReadAll(const wchar_t* filename, std::vector<char>& buffer);
+bool FileWrite(FILE* file, const char* data, size_t size);
+// Flushes stdio buffers and waits until data reaches the disk
+bool FileSync(FILE* file);
+// Atomically renames from over to, so readers see either the old or the new file. Both must be on the same volume.
+// Returns after the rename itself is on disk
+bool FileReplace(const wchar_t* from, const wchar_t* to);
@@ -1,9 +1,17 @@
+#include <cwchar>
+
 #include "LoginForm.h"
+#include "DialogText.h"
 #include "Constants.h"
 #include "resource.h"
 
-LoginResult::LoginResult(User* user, LoginStatus result)
-    : user(user), result(result) { }
+namespace {
+    void ShowHandshake(HWND hwnd, const ChallengeToken& token) {
+        wchar_t text[32];
+        swprintf(text, sizeof(text) / sizeof(text[0]), L"Handshake: %u", token.input);
+        SetWindowTextW(GetDlgItem(hwnd, IDC_HANDSHAKE), text);
+    }
+}
 
 LRESULT CALLBACK RepeatProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam) {
     switch (message) {
@@ -17,17 +25,10 @@ LRESULT CALLBACK RepeatProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lPara
     case WM_COMMAND:
         if (LOWORD(wParam) == IDOK && HIWORD(wParam) == BN_CLICKED) {
             // Get input and check matching
-            const std::wstring* original = (const std::wstring*)GetWindowLongPtrW(hwnd, GWLP_USERDATA);
-            HWND hPassword = GetDlgItem(hwnd, IDC_EDIT_REPEAT);
-            int passwordLength = GetWindowTextLengthW(hPassword);
-            if (passwordLength != original->length()) {
-                MessageBoxW(hwnd, L"Passwords don't match!", L"Warning", MB_OK | MB_ICONERROR);
-                break;
-            }
-
-            std::wstring password;
-            password.resize(passwordLength);
-            GetDlgItemTextW(hwnd, IDC_EDIT_REPEAT, &password[0], passwordLength + 1);
+            const std::wstring_view* original = (const std::wstring_view*)GetWindowLongPtrW(hwnd, GWLP_USERDATA);
+            alignas(std::max_align_t) char buffer[kDialogArenaSize];
+            std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer));
+            std::pmr::wstring password = GetDialogText(hwnd, IDC_EDIT_REPEAT, arena);
             if (password != *original) {
                 MessageBoxW(hwnd, L"Passwords don't match!", L"Warning", MB_OK | MB_ICONERROR);
                 break;
@@ -49,95 +50,69 @@ LRESULT CALLBACK LoginProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam
     case WM_INITDIALOG:
     {
         SetWindowLongPtrW(hwnd, GWLP_USERDATA, lParam);
-        HWND hHandshake = GetDlgItem(hwnd, IDC_HANDSHAKE);
-        std::wstring text = L"Handshake: " + std::to_wstring(((const LoginInput*)lParam)->handshake);
-        SetWindowTextW(hHandshake, text.c_str());
+        ShowHandshake(hwnd, ((const LoginInput*)lParam)->challenge.token);
         break;
     }
     case WM_CLOSE:
-        EndDialog(hwnd, (INT_PTR)new LoginResult(nullptr, LoginStatus::CANCEL));
+        EndDialog(hwnd, (INT_PTR)LoginStatus::CANCEL);
         break;
     case WM_COMMAND:
         if (LOWORD(wParam) == IDOK && HIWORD(wParam) == BN_CLICKED) {
-            // Read user input
-            HWND hLogin = GetDlgItem(hwnd, IDC_EDIT1);
-            HWND hPassword = GetDlgItem(hwnd, IDC_EDIT2);
-            HWND hHandshake = GetDlgItem(hwnd, IDC_EDIT3);
-            int loginLength = GetWindowTextLengthW(hLogin);
-            int passwordLength = GetWindowTextLengthW(hPassword);
-            int handshakeLength = GetWindowTextLengthW(hHandshake);
-            if (loginLength == 0 || passwordLength == 0 || handshakeLength == 0) {
+            // Read user input. Strings of one click live in a stack arena
+            alignas(std::max_align_t) char buffer[kDialogArenaSize];
+            std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer));
+            std::pmr::wstring username = GetDialogText(hwnd, IDC_EDIT1, arena);
+            std::pmr::wstring password = GetDialogText(hwnd, IDC_EDIT2, arena);
+            std::pmr::wstring handshake = GetDialogText(hwnd, IDC_EDIT3, arena);
+            if (username.empty() || password.empty() || handshake.empty()) {
                 break;
             }
 
-            std::wstring username;
-            std::wstring password;
-            std::wstring handshake;
-            username.resize(loginLength);
-            password.resize(passwordLength);
-            handshake.resize(handshakeLength);
-            GetDlgItemTextW(hwnd, IDC_EDIT1, &username[0], loginLength + 1);
-            GetDlgItemTextW(hwnd, IDC_EDIT2, &password[0], passwordLength + 1);
-            GetDlgItemTextW(hwnd, IDC_EDIT3, &handshake[0], handshakeLength + 1);
-            // If user doesn't exist - show warning
             LoginInput* input = (LoginInput*)GetWindowLongPtrW(hwnd, GWLP_USERDATA);
-            User* user = nullptr;
-            for (const std::unique_ptr<User>& currentUser : input->database.users) {
-                if (username == currentUser->username) {
-                    user = currentUser.get();
-                    break;
-                }
-            }
-
-            if (user == nullptr) {
-                MessageBoxW(hwnd, L"User with such name doesn't exist!", L"Warning", MB_OK | MB_ICONERROR);
-                break;
-            }
-
-            if (user->isBlocked) {
-                MessageBoxW(hwnd, L"Account is blocked!", L"Warning", MB_OK | MB_ICONERROR);
-                break;
-            }
-
-            if (!IsHandshakeValid(input->handshake, std::stoi(handshake))) {
-                MessageBoxW(hwnd, L"Wrong handshake!", L"Warning", MB_OK | MB_ICONERROR);
-                break;
-            }
-
+            UserId user;
+            AuthStatus status = input->auth.Login(input->challenge, username, password, handshake, user);
             // If user wasn't registered
-            if (user->password.empty()) {
-                // Validate if set restriction
-                if (user->isRestrictionEnabled && !IsPasswordValid(password)) {
-                    MessageBoxW(hwnd, L"Password must contain latin, cyrillic characters and numbers!", L"Warning", MB_OK | MB_ICONERROR);
-                    break;
-                }
-
+            if (status == AuthStatus::PASSWORD_NOT_SET) {
                 // Ask to repeat password
-                bool match = DialogBoxParamW(GetModuleHandleW(nullptr), MAKEINTRESOURCE(IDD_DIALOG_REPEAT), hwnd, RepeatProc, (LPARAM)&password);
+                std::wstring_view original = password;
+                bool match = DialogBoxParamW(GetModuleHandleW(nullptr), MAKEINTRESOURCE(IDD_DIALOG_REPEAT), hwnd, RepeatProc, (LPARAM)&original);
                 if (!match) {
                     break;
                 }
 
                 // Match - change pass and return
-                user->password = password;
-                EndDialog(hwnd, (INT_PTR)new LoginResult(user, LoginStatus::UPDATE));
+                status = input->auth.SetInitialPassword(user, password);
+                if (status != AuthStatus::OK) {
+                    MessageBoxW(hwnd, input->auth.GetStatusMessage(status), L"Warning", MB_OK | MB_ICONERROR);
+                    break;
+                }
+
+                input->user = user;
+                input->session = input->auth.sessions.Issue(user);
+                EndDialog(hwnd, (INT_PTR)LoginStatus::UPDATE);
                 break;
             }
 
-            // User was registered. Check password. 3 times
-            if (user->password != password) {
-                MessageBoxW(hwnd, L"Wrong password!", L"Warning", MB_OK | MB_ICONERROR);
-                --input->attempts;
+            if (status != AuthStatus::OK) {
+                MessageBoxW(hwnd, input->auth.GetStatusMessage(status), L"Warning", MB_OK | MB_ICONERROR);
                 // No attempts left. Exit
-                if (input->attempts <= 0) {
-                    EndDialog(hwnd, (INT_PTR)new LoginResult(nullptr, LoginStatus::CANCEL));
+                if (status == AuthStatus::NO_ATTEMPTS_LEFT) {
+                    EndDialog(hwnd, (INT_PTR)LoginStatus::CANCEL);
+                }
+
+                // Token may have expired while the form was open, the next attempt gets a fresh one
+                if (status == AuthStatus::WRONG_HANDSHAKE) {
+                    input->challenge.token = input->auth.challenges.Issue();
+                    ShowHandshake(hwnd, input->challenge.token);
                 }
 
                 break;
             }
 
             // Password match. Authorize user
-            EndDialog(hwnd, (INT_PTR)new LoginResult(user, LoginStatus::LOGIN));
+            input->user = user;
+            input->session = input->auth.sessions.Issue(user);
+            EndDialog(hwnd, (INT_PTR)LoginStatus::LOGIN);
         }
 
         break;
@@ -1,7 +1,7 @@
 #pragma once
 
 #include <Windows.h>
-#include "Database.h"
+#include "AuthService.h"
 
 enum class LoginStatus : INT_PTR {
     LOGIN, // User authorized
@@ -9,17 +9,12 @@ enum class LoginStatus : INT_PTR {
     CANCEL // 
 };
 
+// LoginProc ends the dialog with LoginStatus and writes the authorized user and its session here
 struct LoginInput {
-    Database& database;
-    int handshake;
-    int attempts;
-};
-
-struct LoginResult {
-    LoginResult(User* user, LoginStatus result);
-
-    User* user;
-    LoginStatus result;
+    AuthService& auth;
+    LoginChallenge challenge;
+    UserId user;
+    SessionToken session;
 };
 
 LRESULT CALLBACK RepeatProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam);
@@ -1,47 +1,60 @@
 #define _CRT_SECURE_NO_WARNINGS
 
 #include <Windows.h>
-#include <cstdlib>
-#include <memory>
 
 #include "resource.h"
 #include "Console.h"
 #include "Constants.h"
-#include "Database.h"
+#include "AuthService.h"
 #include "LoginForm.h"
 #include "UserPanel.h"
 #include "AdminPanel.h"
+#include "Metrics.h"
 
 #pragma comment(lib, "ConsoleLib")
 
 int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdLine, int nCmdShow) {
-    srand(GetTickCount());
     Database database(kDatabaseFile);
-    User* user;
+    if (database.isCorrupted) {
+        MessageBoxW(nullptr, L"User database is damaged and can't be opened. Restore it from a backup.", L"Error", MB_OK | MB_ICONERROR);
+        return 1;
+    }
+
+    RateLimiter limiter(kRateLimitFile);
+    AuthService auth(database, &limiter);
+    UserId user;
+    SessionToken session;
     // Show login form
     {
-        LoginInput loginParams = { database, rand() % 1000, kAttempts };
-        std::unique_ptr<LoginResult> result((LoginResult*)DialogBoxParamW(hInstance, MAKEINTRESOURCE(IDD_DIALOG1), nullptr, LoginProc, (LPARAM)&loginParams));
-        if (result->result == LoginStatus::CANCEL) {
+        LoginInput loginParams = { auth, { auth.challenges.Issue(), kAttempts, 0 }, kInvalidUser, {} };
+        LoginStatus status = (LoginStatus)DialogBoxParamW(hInstance, MAKEINTRESOURCE(IDD_DIALOG1), nullptr, LoginProc, (LPARAM)&loginParams);
+        // Attempts count across restarts
+        limiter.Save();
+        if (status == LoginStatus::CANCEL || loginParams.user == kInvalidUser) {
+            WriteMetrics(kMetricsFile);
             return 0;
         }
 
-        // Update database if needed
-        if (result->result == LoginStatus::UPDATE) {
-            database.Save();
-        }
-
-        user = result->user;
+        user = loginParams.user;
+        session = loginParams.session;
     }
 
     // Show main form
-    UserPanelInput panelInput = { database, user };
-    if (user->username == kAdminUsername) {
+    UserPanelInput panelInput = { auth, database, user, session };
+    if (database.GetUsername(user) == kAdminUsername) {
         DialogBoxParamW(hInstance, MAKEINTRESOURCE(IDD_ADMIN_PANEL), nullptr, AdminPanelProc, (LPARAM)&panelInput);
     }
     else {
         DialogBoxParamW(hInstance, MAKEINTRESOURCE(IDD_USER_PANEL), nullptr, UserPanelProc, (LPARAM)&panelInput);
     }
 
+    auth.sessions.Revoke(session);
+    // Fold the journal into the snapshot. Skipped if nothing changed
+    if (!database.Save()) {
+        MessageBoxW(nullptr, L"User database can't be written. Changes are kept in its journal.", L"Error", MB_OK | MB_ICONERROR);
+    }
+
+    WriteMetrics(kMetricsFile);
+
 	return 0;
 }
@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Metrics.h"
+#include "FileUtils.h"
+
+namespace {
+    struct CounterInfo {
+        const char* name;
+        const char* labels;
+    };
+
+    constexpr CounterInfo kCounterInfo[kCounters] = {
+        { "pr2_logins_total", "outcome=\"ok\"" },
+        { "pr2_logins_total", "outcome=\"password_not_set\"" },
+        { "pr2_logins_total", "outcome=\"user_not_found\"" },
+        { "pr2_logins_total", "outcome=\"blocked\"" },
+        { "pr2_logins_total", "outcome=\"wrong_handshake\"" },
+        { "pr2_logins_total", "outcome=\"wrong_password\"" },
+        { "pr2_logins_total", "outcome=\"no_attempts_left\"" },
+        { "pr2_logins_total", "outcome=\"invalid_password\"" },
+        { "pr2_logins_total", "outcome=\"rate_limited\"" },
+        { "pr2_database_saves_skipped_total", "" },
+        { "pr2_database_saves_failed_total", "" }
+    };
+
+    constexpr const char* kTimerNames[kTimers] = {
+        "pr2_database_open_seconds",
+        "pr2_database_save_seconds",
+        "pr2_journal_commit_seconds",
+        "pr2_login_seconds"
+    };
+
+    constexpr double kQuantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+    // Written only by the owning thread, read by WriteMetrics
+    struct ThreadMetrics {
+        std::atomic<uint64_t> counters[kCounters];
+        std::atomic<uint64_t> buckets[kTimers][kHistogramBuckets];
+        std::atomic<uint64_t> sums[kTimers];
+    };
+
+    struct Registry {
+        std::mutex lock;
+        std::vector<ThreadMetrics*> threads;
+        // Folded in from threads that exited
+        ThreadMetrics retired;
+    };
+
+    // Never destroyed, threads may exit after static destructors ran
+    Registry& GetRegistry() {
+        static Registry* registry = new Registry();
+        return *registry;
+    }
+
+    // Single writer, so no read-modify-write instruction is needed
+    inline void Add(std::atomic<uint64_t>& value, uint64_t delta) {
+        value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    struct ThreadRegistration {
+        ThreadRegistration() {
+            Registry& registry = GetRegistry();
+            std::lock_guard<std::mutex> guard(registry.lock);
+            registry.threads.push_back(&metrics);
+        }
+
+        ~ThreadRegistration() {
+            Registry& registry = GetRegistry();
+            std::lock_guard<std::mutex> guard(registry.lock);
+            for (size_t i = 0; i < kCounters; ++i) {
+                Add(registry.retired.counters[i], metrics.counters[i].load(std::memory_order_relaxed));
+            }
+
+            for (size_t timer = 0; timer < kTimers; ++timer) {
+                for (size_t bucket = 0; bucket < kHistogramBuckets; ++bucket) {
+                    Add(registry.retired.buckets[timer][bucket], metrics.buckets[timer][bucket].load(std::memory_order_relaxed));
+                }
+
+                Add(registry.retired.sums[timer], metrics.sums[timer].load(std::memory_order_relaxed));
+            }
+
+            registry.threads.erase(std::find(registry.threads.begin(), registry.threads.end(), &metrics));
+        }
+
+        ThreadMetrics metrics = {};
+    };
+
+    ThreadMetrics& GetThreadMetrics() {
+        thread_local ThreadRegistration registration;
+        return registration.metrics;
+    }
+
+    // Values below kHistogramSubBuckets get a bucket each, above it every power of two gets kHistogramSubBuckets
+    size_t GetBucket(uint64_t nanoseconds) {
+        if (nanoseconds < kHistogramSubBuckets) {
+            return (size_t)nanoseconds;
+        }
+
+        size_t exponent = std::bit_width(nanoseconds) - 1;
+        size_t subBucket = (size_t)(nanoseconds >> (exponent - 4)) & (kHistogramSubBuckets - 1);
+        return std::min((exponent - 3) * kHistogramSubBuckets + subBucket, kHistogramBuckets - 1);
+    }
+
+    // Middle of the bucket
+    double GetBucketValue(size_t bucket) {
+        if (bucket < kHistogramSubBuckets) {
+            return (double)bucket;
+        }
+
+        size_t exponent = bucket / kHistogramSubBuckets + 3;
+        double width = (double)(1ull << (exponent - 4));
+        return (double)(kHistogramSubBuckets + bucket % kHistogramSubBuckets) * width + width / 2;
+    }
+
+    void Append(std::string& text, const char* format, ...) {
+        char line[256];
+        va_list args;
+        va_start(args, format);
+        vsnprintf(line, sizeof(line), format, args);
+        va_end(args);
+        text.append(line);
+    }
+}
+
+void CountEvent(Counter counter) {
+    Add(GetThreadMetrics().counters[(size_t)counter], 1);
+}
+
+void RecordTime(Timer timer, uint64_t nanoseconds) {
+    ThreadMetrics& metrics = GetThreadMetrics();
+    Add(metrics.buckets[(size_t)timer][GetBucket(nanoseconds)], 1);
+    Add(metrics.sums[(size_t)timer], nanoseconds);
+}
+
+bool WriteMetrics(const wchar_t* filename) {
+    uint64_t counters[kCounters] = {};
+    std::vector<uint64_t> buckets(kTimers * kHistogramBuckets);
+    uint64_t sums[kTimers] = {};
+    {
+        Registry& registry = GetRegistry();
+        std::lock_guard<std::mutex> guard(registry.lock);
+        std::vector<const ThreadMetrics*> sources(registry.threads.begin(), registry.threads.end());
+        sources.push_back(&registry.retired);
+        for (const ThreadMetrics* source : sources) {
+            for (size_t i = 0; i < kCounters; ++i) {
+                counters[i] += source->counters[i].load(std::memory_order_relaxed);
+            }
+
+            for (size_t timer = 0; timer < kTimers; ++timer) {
+                for (size_t bucket = 0; bucket < kHistogramBuckets; ++bucket) {
+                    buckets[timer * kHistogramBuckets + bucket] += source->buckets[timer][bucket].load(std::memory_order_relaxed);
+                }
+
+                sums[timer] += source->sums[timer].load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::string text;
+    for (size_t i = 0; i < kCounters; ++i) {
+        // Labelled series of one metric are next to each other and share the header
+        if (i == 0 || strcmp(kCounterInfo[i].name, kCounterInfo[i - 1].name) != 0) {
+            Append(text, "# TYPE %s counter\n", kCounterInfo[i].name);
+        }
+
+        if (kCounterInfo[i].labels[0] != '\0') {
+            Append(text, "%s{%s} %llu\n", kCounterInfo[i].name, kCounterInfo[i].labels, (unsigned long long)counters[i]);
+        }
+        else {
+            Append(text, "%s %llu\n", kCounterInfo[i].name, (unsigned long long)counters[i]);
+        }
+    }
+
+    for (size_t timer = 0; timer < kTimers; ++timer) {
+        const uint64_t* histogram = &buckets[timer * kHistogramBuckets];
+        uint64_t count = 0;
+        for (size_t bucket = 0; bucket < kHistogramBuckets; ++bucket) {
+            count += histogram[bucket];
+        }
+
+        Append(text, "# TYPE %s summary\n", kTimerNames[timer]);
+        for (double quantile : kQuantiles) {
+            // Rank of the quantile, 1-based
+            uint64_t rank = std::max<uint64_t>(1, (uint64_t)(quantile * count + 0.5));
+            uint64_t seen = 0;
+            double value = 0;
+            for (size_t bucket = 0; bucket < kHistogramBuckets && count != 0; ++bucket) {
+                seen += histogram[bucket];
+                if (seen >= rank) {
+                    value = GetBucketValue(bucket);
+                    break;
+                }
+            }
+
+            Append(text, "%s{quantile=\"%g\"} %.9f\n", kTimerNames[timer], quantile, value / 1e9);
+        }
+
+        Append(text, "%s_sum %.9f\n", kTimerNames[timer], sums[timer] / 1e9);
+        Append(text, "%s_count %llu\n", kTimerNames[timer], (unsigned long long)count);
+    }
+
+    std::wstring tempFilename = std::wstring(filename) + L".tmp";
+    FILE* file = FileOpen(tempFilename.c_str(), L"wb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    bool written = FileWrite(file, text.data(), text.size());
+    fclose(file);
+    return written && FileReplace(tempFilename.c_str(), filename);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+// Build with PR2_METRICS=0 to compile every METRICS_ macro out
+#ifndef PR2_METRICS
+#define PR2_METRICS 1
+#endif
+
+enum class Counter : uint8_t {
+    // One per AuthStatus returned by AuthService::Login
+    LOGIN_OK,
+    LOGIN_PASSWORD_NOT_SET,
+    LOGIN_USER_NOT_FOUND,
+    LOGIN_BLOCKED,
+    LOGIN_WRONG_HANDSHAKE,
+    LOGIN_WRONG_PASSWORD,
+    LOGIN_NO_ATTEMPTS_LEFT,
+    LOGIN_INVALID_PASSWORD,
+    LOGIN_RATE_LIMITED,
+    SAVES_SKIPPED,
+    SAVES_FAILED,
+    COUNT
+};
+
+enum class Timer : uint8_t {
+    DATABASE_OPEN,
+    // Saves that wrote a snapshot
+    DATABASE_SAVE,
+    // Journal batch write and sync
+    JOURNAL_COMMIT,
+    LOGIN,
+    COUNT
+};
+
+constexpr size_t kCounters = (size_t)Counter::COUNT;
+constexpr size_t kTimers = (size_t)Timer::COUNT;
+// Log-linear latency buckets: every power of two of nanoseconds is split into this many, about 6% precision
+constexpr size_t kHistogramSubBuckets = 16;
+constexpr size_t kHistogramBuckets = 61 * kHistogramSubBuckets;
+
+// Counters and histograms are per thread, so recording is a few relaxed stores without contention.
+// Readers sum all threads, values of exited threads are kept
+void CountEvent(Counter counter);
+void RecordTime(Timer timer, uint64_t nanoseconds);
+// Prometheus text exposition format. File is replaced atomically, so a scraper never sees a partial dump
+bool WriteMetrics(const wchar_t* filename);
+
+// Records time from construction to destruction
+struct ScopedTimer {
+    ScopedTimer(Timer timer)
+        : timer(timer), start(std::chrono::steady_clock::now()) {}
+
+    ~ScopedTimer() {
+        RecordTime(timer, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    Timer timer;
+    std::chrono::steady_clock::time_point start;
+};
+
+#if PR2_METRICS
+#define METRICS_CONCAT_(a, b) a##b
+#define METRICS_CONCAT(a, b) METRICS_CONCAT_(a, b)
+#define METRICS_COUNT(counter) CountEvent(counter)
+// Times the rest of the enclosing scope
+#define METRICS_TIME(timer) ScopedTimer METRICS_CONCAT(scopedTimer, __LINE__)(timer)
+#else
+#define METRICS_COUNT(counter) ((void)0)
+#define METRICS_TIME(timer) ((void)0)
+#endif
@@ -0,0 +1,158 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory_resource>
+#include <mutex>
+#include <random>
+#include <thread>
+
+#include "PasswordHasher.h"
+#include "Encoding.h"
+
+namespace {
+    // PBKDF2-HMAC-SHA256 with one output block
+    void Pbkdf2Sha256(std::string_view password, const PasswordHash& parameters, uint8_t (&hash)[kSha256Size]) {
+        HmacSha256 hmac(password.data(), password.size());
+        uint8_t message[kSaltSize + 4];
+        memcpy(message, parameters.salt, kSaltSize);
+        message[kSaltSize] = 0;
+        message[kSaltSize + 1] = 0;
+        message[kSaltSize + 2] = 0;
+        message[kSaltSize + 3] = 1;
+        uint8_t block[kSha256Size];
+        hmac.Sign(message, sizeof(message), block);
+        memcpy(hash, block, sizeof(block));
+        for (uint32_t i = 1; i < parameters.iterations; ++i) {
+            hmac.Sign(block, sizeof(block), block);
+            for (size_t byte = 0; byte < kSha256Size; ++byte) {
+                hash[byte] ^= block[byte];
+            }
+        }
+    }
+
+    // Written only by RegisterKdf before other threads start, so lookups need no lock
+    Kdf kdfs[256] = { nullptr, Pbkdf2Sha256 };
+
+    // Opening a random device per salt costs more than reading it. One device serves every thread
+    void FillRandom(uint8_t* data, size_t size) {
+        static std::random_device random;
+        static std::mutex lock;
+        std::lock_guard<std::mutex> guard(lock);
+        for (size_t i = 0; i < size; i += sizeof(unsigned int)) {
+            unsigned int value = random();
+            memcpy(data + i, &value, std::min(sizeof(value), size - i));
+        }
+    }
+
+    // UTF-8 copy lives in the caller's arena
+    std::pmr::string ToUtf8(std::wstring_view password, std::pmr::memory_resource& arena) {
+        std::pmr::string utf8(&arena);
+        utf8.reserve(Utf8Length(password));
+        WriteUtf8(utf8, password);
+        return utf8;
+    }
+
+    // Runs task(i) for every i in [0, count) on all cores
+    template<typename Task>
+    void ParallelFor(size_t count, Task task) {
+        size_t threadCount = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), count);
+        if (threadCount < 2) {
+            for (size_t i = 0; i < count; ++i) {
+                task(i);
+            }
+
+            return;
+        }
+
+        std::atomic<size_t> next = 0;
+        std::vector<std::thread> threads;
+        for (size_t thread = 0; thread < threadCount; ++thread) {
+            threads.emplace_back([&next, &task, count]() {
+                for (size_t i = next++; i < count; i = next++) {
+                    task(i);
+                }
+            });
+        }
+
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+}
+
+void RegisterKdf(KdfAlgorithm algorithm, Kdf kdf) {
+    kdfs[(uint8_t)algorithm] = kdf;
+}
+
+PasswordHash HashPassword(std::wstring_view password, KdfAlgorithm algorithm, uint32_t iterations) {
+    PasswordHash hash = {};
+    if (password.empty() || kdfs[(uint8_t)algorithm] == nullptr) {
+        hash.algorithm = KdfAlgorithm::NONE;
+        return hash;
+    }
+
+    hash.algorithm = algorithm;
+    hash.iterations = std::clamp(iterations, kMinKdfIterations, kMaxKdfIterations);
+    FillRandom(hash.salt, kSaltSize);
+
+    alignas(std::max_align_t) char buffer[kPasswordArenaSize];
+    std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer));
+    kdfs[(uint8_t)algorithm](ToUtf8(password, arena), hash, hash.hash);
+    return hash;
+}
+
+bool VerifyPassword(std::wstring_view password, const PasswordHash& hash) {
+    Kdf kdf = kdfs[(uint8_t)hash.algorithm];
+    if (hash.algorithm == KdfAlgorithm::NONE || kdf == nullptr) {
+        return false;
+    }
+
+    // Typical passwords fit the stack arena, so verification doesn't allocate
+    alignas(std::max_align_t) char buffer[kPasswordArenaSize];
+    std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer));
+    uint8_t derived[kSha256Size];
+    kdf(ToUtf8(password, arena), hash, derived);
+    return ConstantTimeEqual(derived, hash.hash, kSha256Size);
+}
+
+std::vector<uint8_t> VerifyBatch(const std::vector<Credential>& attempts) {
+    std::vector<uint8_t> results(attempts.size(), 0);
+    ParallelFor(attempts.size(), [&attempts, &results](size_t i) {
+        results[i] = VerifyPassword(attempts[i].password, *attempts[i].hash);
+    });
+
+    return results;
+}
+
+std::vector<PasswordHash> HashBatch(const std::vector<std::wstring>& passwords) {
+    std::vector<PasswordHash> hashes(passwords.size());
+    ParallelFor(passwords.size(), [&passwords, &hashes](size_t i) {
+        hashes[i] = HashPassword(passwords[i]);
+    });
+
+    return hashes;
+}
+
+void WritePasswordHash(std::vector<char>& buffer, const PasswordHash& hash) {
+    buffer.push_back((char)hash.algorithm);
+    WriteUint32(buffer, hash.iterations);
+    buffer.insert(buffer.end(), (const char*)hash.salt, (const char*)hash.salt + kSaltSize);
+    buffer.insert(buffer.end(), (const char*)hash.hash, (const char*)hash.hash + kSha256Size);
+}
+
+const char* ReadPasswordHash(const char* data, const char* end, PasswordHash& hash) {
+    if ((size_t)(end - data) < kPasswordHashSize || kdfs[(uint8_t)*data] == nullptr) {
+        return nullptr;
+    }
+
+    hash.algorithm = (KdfAlgorithm)*data++;
+    data = ReadUint32(data, end, hash.iterations);
+    if (hash.iterations < kMinKdfIterations || hash.iterations > kMaxKdfIterations) {
+        return nullptr;
+    }
+
+    memcpy(hash.salt, data, kSaltSize);
+    data += kSaltSize;
+    memcpy(hash.hash, data, kSha256Size);
+    return data + kSha256Size;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+#include "Sha256.h"
+
+enum class KdfAlgorithm : uint8_t {
+    NONE, // Password isn't set
+    PBKDF2_SHA256
+};
+
+constexpr size_t kSaltSize = 16;
+constexpr KdfAlgorithm kDefaultKdf = KdfAlgorithm::PBKDF2_SHA256;
+// Main knob for login CPU cost. Parameters are stored with every hash, so changing it only affects new passwords
+constexpr uint32_t kDefaultKdfIterations = 100000;
+// Iterations a stored hash may have. Fewer is too cheap to crack, more lets a crafted import stall every login
+constexpr uint32_t kMinKdfIterations = 1000;
+constexpr uint32_t kMaxKdfIterations = 10000000;
+// Stack arena for the UTF-8 copy of a password. Longer passwords spill to the heap
+constexpr size_t kPasswordArenaSize = 512;
+
+// Salted hash together with the KDF parameters that produced it. Same size for every user
+struct PasswordHash {
+    KdfAlgorithm algorithm;
+    uint32_t iterations;
+    uint8_t salt[kSaltSize];
+    uint8_t hash[kSha256Size];
+};
+
+// Serialized hash: [algorithm][iterations][salt][hash], iterations are little-endian
+constexpr size_t kPasswordHashSize = 1 + 4 + kSaltSize + kSha256Size;
+
+// Password is UTF-8. Reads salt and iterations from parameters
+using Kdf = void (*)(std::string_view password, const PasswordHash& parameters, uint8_t (&hash)[kSha256Size]);
+
+// Replaces implementation of algorithm. Not synchronized, call it at startup before any thread hashes or verifies
+void RegisterKdf(KdfAlgorithm algorithm, Kdf kdf);
+// Empty password gives KdfAlgorithm::NONE. Iterations are clamped to [kMinKdfIterations, kMaxKdfIterations]
+PasswordHash HashPassword(std::wstring_view password, KdfAlgorithm algorithm = kDefaultKdf, uint32_t iterations = kDefaultKdfIterations);
+// Always false if password isn't set
+bool VerifyPassword(std::wstring_view password, const PasswordHash& hash);
+
+struct Credential {
+    std::wstring_view password;
+    const PasswordHash* hash;
+};
+
+// Verifies attempts on all cores. Result is 1 for every matching attempt
+std::vector<uint8_t> VerifyBatch(const std::vector<Credential>& attempts);
+// Hashes passwords with default parameters on all cores
+std::vector<PasswordHash> HashBatch(const std::vector<std::wstring>& passwords);
+
+void WritePasswordHash(std::vector<char>& buffer, const PasswordHash& hash);
+// Returns nullptr if data is truncated, algorithm is NONE or unknown, or iterations are out of bounds
+const char* ReadPasswordHash(const char* data, const char* end, PasswordHash& hash);
@@ -0,0 +1,50 @@
+#include <vector>
+
+#include "PasswordPolicy.h"
+
+namespace {
+    // "a", "a and b", "a, b and c"
+    std::wstring Join(const std::vector<std::wstring>& names) {
+        std::wstring text;
+        for (size_t i = 0; i < names.size(); ++i) {
+            if (i != 0) {
+                text += i + 1 == names.size() ? L" and " : L", ";
+            }
+
+            text += names[i];
+        }
+
+        return text;
+    }
+}
+
+std::wstring DescribePasswordPolicy(const PasswordPolicy& policy) {
+    std::vector<std::wstring> required;
+    std::vector<std::wstring> optional;
+    for (size_t i = 0; i < policy.classes.size(); ++i) {
+        ((policy.required & (1 << i)) != 0 ? required : optional).push_back(policy.classes[i].name);
+    }
+
+    std::vector<std::wstring> parts;
+    if (!required.empty()) {
+        parts.push_back(L"have " + Join(required));
+    }
+
+    if (!optional.empty()) {
+        parts.push_back(L"may also have " + Join(optional));
+    }
+
+    if (policy.minLength > 1) {
+        parts.push_back(L"be at least " + std::to_wstring(policy.minLength) + L" characters long");
+    }
+
+    if (policy.maxLength != SIZE_MAX) {
+        parts.push_back(L"be at most " + std::to_wstring(policy.maxLength) + L" characters long");
+    }
+
+    if (!policy.denied.empty()) {
+        parts.push_back(L"not be a common password");
+    }
+
+    return L"Password should " + Join(parts);
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+
+// Policies classify UTF-16 code units, characters outside the table are never allowed
+constexpr size_t kPolicyTableSize = 0x10000;
+// Class bits share a table byte with kCharAllowed
+constexpr size_t kMaxCharClasses = 7;
+constexpr uint8_t kCharAllowed = 0x80;
+
+// Inclusive range of code units
+struct CharRange {
+    uint32_t first;
+    uint32_t last;
+};
+
+struct CharClassRule {
+    // Shown in the policy description, e.g. "digits"
+    const wchar_t* name;
+    std::span<const CharRange> ranges;
+    // Password must have at least one character of the class
+    bool isRequired;
+};
+
+// Policy description. Spans must outlive the compiled policy
+struct PasswordRules {
+    // Only characters of these classes are allowed. Class of a character that is in several is the first one
+    std::span<const CharClassRule> classes;
+    // In code units
+    size_t minLength;
+    size_t maxLength;
+    // Passwords rejected as a whole. Sorted, compared exactly
+    std::span<const std::wstring_view> denied;
+};
+
+// Rules compiled into a lookup table, so a password is checked in one pass with one lookup per character
+struct PasswordPolicy {
+    constexpr bool IsValid(std::wstring_view password) const {
+        if (password.length() < minLength || password.length() > maxLength) {
+            return false;
+        }
+
+        uint8_t seen = 0;
+        uint8_t allowed = kCharAllowed;
+        for (wchar_t ch : password) {
+            // Last entry is a noncharacter and never allowed, so it stands for everything above it
+            uint8_t entry = table[std::min<uint32_t>((uint32_t)ch, kPolicyTableSize - 1)];
+            seen |= entry;
+            allowed &= entry;
+        }
+
+        return allowed != 0 && (seen & required) == required && !std::binary_search(denied.begin(), denied.end(), password);
+    }
+
+    // Result is 1 for every valid password, results must be at least as long as passwords. Returns number of valid ones
+    constexpr size_t ValidateAll(std::span<const std::wstring_view> passwords, std::span<uint8_t> results) const {
+        size_t valid = 0;
+        for (size_t i = 0; i < passwords.size() && i < results.size(); ++i) {
+            results[i] = IsValid(passwords[i]);
+            valid += results[i];
+        }
+
+        return valid;
+    }
+
+    // Class bit and kCharAllowed for every allowed code unit, 0 for the rest
+    std::array<uint8_t, kPolicyTableSize> table;
+    // Class bits a password must have
+    uint8_t required;
+    size_t minLength;
+    size_t maxLength;
+    std::span<const std::wstring_view> denied;
+    std::span<const CharClassRule> classes;
+};
+
+// Returns false if rules have more than kMaxCharClasses classes, a range is reversed or reaches the last table entry,
+// or denied isn't sorted. Works at compile time too
+constexpr bool CompilePasswordPolicy(const PasswordRules& rules, PasswordPolicy& policy) {
+    if (rules.classes.size() > kMaxCharClasses || !std::is_sorted(rules.denied.begin(), rules.denied.end())) {
+        return false;
+    }
+
+    policy.table = {};
+    policy.required = 0;
+    for (size_t i = 0; i < rules.classes.size(); ++i) {
+        uint8_t bit = (uint8_t)(1 << i);
+        for (const CharRange& range : rules.classes[i].ranges) {
+            if (range.first > range.last || range.last >= kPolicyTableSize - 1) {
+                return false;
+            }
+
+            for (uint32_t ch = range.first; ch <= range.last; ++ch) {
+                if (policy.table[ch] == 0) {
+                    policy.table[ch] = bit | kCharAllowed;
+                }
+            }
+        }
+
+        if (rules.classes[i].isRequired) {
+            policy.required |= bit;
+        }
+    }
+
+    policy.minLength = rules.minLength;
+    policy.maxLength = rules.maxLength;
+    policy.denied = rules.denied;
+    policy.classes = rules.classes;
+    return true;
+}
+
+// "Password should have ..." sentence listing the rules
+std::wstring DescribePasswordPolicy(const PasswordPolicy& policy);
+
+inline constexpr CharRange kLatinRanges[] = { { L'A', L'Z' }, { L'a', L'z' } };
+// Cyrillic block without U+0482..U+0489 (sign and combining marks)
+inline constexpr CharRange kCyrillicRanges[] = { { 0x0400, 0x0481 }, { 0x048A, 0x04FF } };
+inline constexpr CharRange kDigitRanges[] = { { L'0', L'9' } };
+inline constexpr CharClassRule kDefaultPasswordClasses[] = {
+    { L"latin letters", kLatinRanges, true },
+    { L"cyrillic letters", kCyrillicRanges, true },
+    { L"digits", kDigitRanges, true }
+};
+
+// Latin, cyrillic and digits, each at least once, nothing else. Table is built by the compiler
+inline constexpr PasswordPolicy kDefaultPasswordPolicy = []() {
+    PasswordPolicy policy = {};
+    CompilePasswordPolicy({ kDefaultPasswordClasses, 0, SIZE_MAX, {} }, policy);
+    return policy;
+}();
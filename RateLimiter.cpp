@@ -0,0 +1,233 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "RateLimiter.h"
+#include "FileUtils.h"
+#include "Encoding.h"
+
+namespace {
+    constexpr uint64_t kTokenScale = 256;
+    constexpr uint64_t kTokenMask = 0xFFFF;
+
+    // Steady time is shifted up by this, so a bucket loaded from the file that was last refilled before the
+    // steady epoch (usually boot) still gets a time in the past
+    constexpr uint64_t kClockBaseMs = 1ull << 40;
+
+    // Buckets refill by steady time, a wall clock set back would stall them
+    uint64_t NowMs() {
+        return kClockBaseMs + (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // File keeps wall time, the steady clock restarts with the machine
+    uint64_t WallNowMs() {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // Scaled tokens in the bucket at time now
+    uint64_t Refill(uint64_t state, uint64_t now, uint32_t burst, uint64_t refillMs) {
+        uint64_t full = burst * kTokenScale;
+        if (state == 0) {
+            return full;
+        }
+
+        uint64_t time = state >> 16;
+        uint64_t tokens = state & kTokenMask;
+        if (now > time) {
+            tokens = std::min(full, tokens + (now - time) * kTokenScale / refillMs);
+        }
+
+        return tokens;
+    }
+
+    // splitmix64 finalizer
+    uint64_t Mix(uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xBF58476D1CE4E5B9ull;
+        x ^= x >> 27;
+        x *= 0x94D049BB133111EBull;
+        return x ^ (x >> 31);
+    }
+
+    void WriteUint64(std::vector<char>& buffer, uint64_t value) {
+        WriteUint32(buffer, (uint32_t)value);
+        WriteUint32(buffer, (uint32_t)(value >> 32));
+    }
+
+    const char* ReadUint64(const char* data, const char* end, uint64_t& value) {
+        uint32_t low;
+        uint32_t high;
+        data = ReadUint32(data, end, low);
+        data = data == nullptr ? nullptr : ReadUint32(data, end, high);
+        if (data != nullptr) {
+            value = low | ((uint64_t)high << 32);
+        }
+
+        return data;
+    }
+
+    // Converts refill times of a state between clocks, keeping how long ago they were
+    uint64_t ShiftTime(uint64_t state, uint64_t fromNow, uint64_t toNow) {
+        uint64_t time = state >> 16;
+        uint64_t age = std::min(fromNow > time ? fromNow - time : 0, std::min(toNow, kClockBaseMs));
+        return ((toNow - age) << 16) | (state & kTokenMask);
+    }
+
+    void WriteTable(std::vector<char>& buffer, const TokenBucketTable& table, uint64_t now, uint64_t wallNow) {
+        uint64_t count = 0;
+        for (size_t slot = 0; slot < kRateLimitSlots; ++slot) {
+            count += table.slots[slot].load(std::memory_order_relaxed) != 0;
+        }
+
+        WriteVarint(buffer, count);
+        for (size_t slot = 0; slot < kRateLimitSlots; ++slot) {
+            uint64_t state = table.slots[slot].load(std::memory_order_relaxed);
+            if (state != 0) {
+                WriteVarint(buffer, slot);
+                WriteUint64(buffer, ShiftTime(state, now, wallNow));
+            }
+        }
+    }
+
+    const char* ReadTable(const char* data, const char* end, TokenBucketTable& table, uint64_t now, uint64_t wallNow) {
+        uint64_t count;
+        data = ReadVarint(data, end, count);
+        for (uint64_t i = 0; data != nullptr && i < count; ++i) {
+            uint64_t slot;
+            uint64_t state;
+            data = ReadVarint(data, end, slot);
+            data = data == nullptr ? nullptr : ReadUint64(data, end, state);
+            if (data == nullptr || slot >= kRateLimitSlots) {
+                return nullptr;
+            }
+
+            // Wall clock set back since the save gives no refill for the time in between
+            table.slots[slot].store(state == 0 ? 0 : ShiftTime(state, wallNow, now), std::memory_order_relaxed);
+        }
+
+        return data;
+    }
+}
+
+TokenBucketTable::TokenBucketTable(uint32_t burst, uint64_t refillMs)
+    : burst(burst), refillMs(refillMs), slots(new std::atomic<uint64_t>[kRateLimitSlots]) {
+    for (size_t slot = 0; slot < kRateLimitSlots; ++slot) {
+        slots[slot].store(0, std::memory_order_relaxed);
+    }
+}
+
+bool TokenBucketTable::TryAcquire(uint64_t key, uint64_t now) {
+    std::atomic<uint64_t>& slot = slots[key & (kRateLimitSlots - 1)];
+    uint64_t state = slot.load(std::memory_order_relaxed);
+    uint64_t tokens;
+    do {
+        tokens = Refill(state, now, burst, refillMs);
+        if (tokens < kTokenScale) {
+            return false;
+        }
+    } while (!slot.compare_exchange_weak(state, (now << 16) | (tokens - kTokenScale), std::memory_order_relaxed));
+
+    return true;
+}
+
+void TokenBucketTable::Refund(uint64_t key, uint64_t now) {
+    std::atomic<uint64_t>& slot = slots[key & (kRateLimitSlots - 1)];
+    uint64_t state = slot.load(std::memory_order_relaxed);
+    uint64_t tokens;
+    do {
+        tokens = std::min<uint64_t>(burst * kTokenScale, Refill(state, now, burst, refillMs) + kTokenScale);
+    } while (!slot.compare_exchange_weak(state, (now << 16) | tokens, std::memory_order_relaxed));
+}
+
+RateLimiter::RateLimiter(const wchar_t* filename)
+    : filename(filename), secret(0), users(kUserAttemptBurst, kUserRefillMs), sources(kSourceAttemptBurst, kSourceRefillMs) {
+    std::vector<char> buffer;
+    size_t headerSize = sizeof(kRateLimitMagic) + 1;
+    if (FileReadAll(filename, buffer) && buffer.size() > headerSize + sizeof(uint32_t)
+        && memcmp(buffer.data(), kRateLimitMagic, sizeof(kRateLimitMagic)) == 0 && (uint8_t)buffer[sizeof(kRateLimitMagic)] == kRateLimitVersion) {
+        const char* data = buffer.data() + headerSize;
+        const char* end = buffer.data() + buffer.size() - sizeof(uint32_t);
+        uint32_t crc;
+        ReadUint32(end, end + sizeof(crc), crc);
+        if (Crc32c(data, (size_t)(end - data)) == crc) {
+            uint64_t now = NowMs();
+            uint64_t wallNow = WallNowMs();
+            data = ReadUint64(data, end, secret);
+            data = data == nullptr ? nullptr : ReadTable(data, end, users, now, wallNow);
+            data = data == nullptr ? nullptr : ReadTable(data, end, sources, now, wallNow);
+        }
+        else {
+            data = nullptr;
+        }
+
+        if (data == end) {
+            return;
+        }
+    }
+
+    // Missing or damaged. Start over with a fresh secret
+    std::random_device random;
+    secret = ((uint64_t)random() << 32) | random();
+    for (size_t slot = 0; slot < kRateLimitSlots; ++slot) {
+        users.slots[slot].store(0, std::memory_order_relaxed);
+        sources.slots[slot].store(0, std::memory_order_relaxed);
+    }
+}
+
+void RateLimiter::Save() const {
+    std::vector<char> buffer(kRateLimitMagic, kRateLimitMagic + sizeof(kRateLimitMagic));
+    buffer.push_back((char)kRateLimitVersion);
+    size_t headerSize = buffer.size();
+    uint64_t now = NowMs();
+    uint64_t wallNow = WallNowMs();
+    WriteUint64(buffer, secret);
+    WriteTable(buffer, users, now, wallNow);
+    WriteTable(buffer, sources, now, wallNow);
+    WriteUint32(buffer, Crc32c(buffer.data() + headerSize, buffer.size() - headerSize));
+
+    std::wstring tempFilename = std::wstring(filename) + L".tmp";
+    FILE* file = FileOpen(tempFilename.c_str(), L"wb");
+    if (file == nullptr) {
+        return;
+    }
+
+    bool written = FileWrite(file, buffer.data(), buffer.size()) && FileSync(file);
+    fclose(file);
+    if (written) {
+        FileReplace(tempFilename.c_str(), filename);
+    }
+}
+
+bool RateLimiter::TryAcquireUser(std::wstring_view username) {
+    return users.TryAcquire(HashUsername(username), NowMs());
+}
+
+bool RateLimiter::TryAcquireSource(uint64_t source) {
+    return sources.TryAcquire(HashSource(source), NowMs());
+}
+
+void RateLimiter::RefundUser(std::wstring_view username) {
+    users.Refund(HashUsername(username), NowMs());
+}
+
+void RateLimiter::RefundSource(uint64_t source) {
+    sources.Refund(HashSource(source), NowMs());
+}
+
+uint64_t RateLimiter::HashUsername(std::wstring_view username) const {
+    // FNV-1a started from the secret
+    uint64_t hash = 14695981039346656037ull ^ secret;
+    for (wchar_t ch : username) {
+        hash ^= (uint64_t)ch;
+        hash *= 1099511628211ull;
+    }
+
+    return Mix(hash);
+}
+
+uint64_t RateLimiter::HashSource(uint64_t source) const {
+    return Mix(source ^ Mix(secret));
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string_view>
+#include <cstdint>
+
+// Login attempts a username gets at once, then one more every kUserRefillMs
+constexpr uint32_t kUserAttemptBurst = 5;
+constexpr uint64_t kUserRefillMs = 30000;
+// Same for one client over all usernames it tries
+constexpr uint32_t kSourceAttemptBurst = 20;
+constexpr uint64_t kSourceRefillMs = 3000;
+// Power of two
+constexpr size_t kRateLimitSlots = 65536;
+
+// File: [magic][version][secret], then for both tables [slotCount] and [slot][state] pairs, then crc32c of everything after the header
+constexpr char kRateLimitMagic[4] = { 'P', 'R', '2', 'R' };
+constexpr uint8_t kRateLimitVersion = 1;
+
+// Token buckets in a fixed table. Keys are hashed to slots, colliding keys share a bucket.
+// Slot is one atomic word: [last refill in steady clock ms: 48][tokens * 256: 16], 0 - full bucket.
+// The file stores refill times in ms since 1970 instead
+struct TokenBucketTable {
+    TokenBucketTable(uint32_t burst, uint64_t refillMs);
+
+    // Takes a token. Rejection only reads the slot
+    bool TryAcquire(uint64_t key, uint64_t now);
+    // Gives a token back, up to the burst
+    void Refund(uint64_t key, uint64_t now);
+
+    uint32_t burst;
+    uint64_t refillMs;
+    std::unique_ptr<std::atomic<uint64_t>[]> slots;
+};
+
+// Persistent login throttling per username and per source (client identity, 0 - local user).
+// Lock-free, checked before the password hash, so a brute force never reaches the KDF
+struct RateLimiter {
+    // Starts with full buckets if file is missing or damaged
+    RateLimiter(const wchar_t* filename);
+    RateLimiter(const RateLimiter& other) = delete;
+
+    void Save() const;
+    bool TryAcquireUser(std::wstring_view username);
+    bool TryAcquireSource(uint64_t source);
+    // Successful login gives the attempt back
+    void RefundUser(std::wstring_view username);
+    void RefundSource(uint64_t source);
+
+    const wchar_t* filename;
+    // Seeds key hashes, so slots of a username can't be predicted without the file
+    uint64_t secret;
+    TokenBucketTable users;
+    TokenBucketTable sources;
+
+private:
+    uint64_t HashUsername(std::wstring_view username) const;
+    uint64_t HashSource(uint64_t source) const;
+};
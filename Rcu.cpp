@@ -0,0 +1,92 @@
+#include <atomic>
+
+#include "Rcu.h"
+
+namespace {
+    constexpr size_t kMaxReaderThreads = 256;
+
+    // Own cache line, so readers on different cores don't contend
+    struct alignas(64) ReaderSlot {
+        // Epoch at which the current read started, 0 - not reading
+        std::atomic<uint64_t> epoch;
+        std::atomic<bool> isTaken;
+    };
+
+    ReaderSlot slots[kMaxReaderThreads];
+    std::atomic<uint64_t> globalEpoch = 1;
+    // Readers that didn't get a slot. Nothing is reclaimed while any of them runs
+    std::atomic<size_t> overflowReaders = 0;
+
+    struct ThreadReader {
+        ~ThreadReader() {
+            if (slot != nullptr) {
+                slot->isTaken = false;
+            }
+        }
+
+        ReaderSlot* slot = nullptr;
+        size_t depth = 0;
+        bool isRegistered = false;
+    };
+
+    thread_local ThreadReader reader;
+}
+
+ReadSection::ReadSection() {
+    if (reader.depth++ != 0) {
+        return;
+    }
+
+    if (!reader.isRegistered) {
+        reader.isRegistered = true;
+        for (ReaderSlot& slot : slots) {
+            bool isTaken = false;
+            if (slot.isTaken.compare_exchange_strong(isTaken, true)) {
+                reader.slot = &slot;
+                break;
+            }
+        }
+    }
+
+    // Announced before the caller loads a version. A writer that doesn't see the announcement
+    // has already published, so the reader can only get the new version
+    if (reader.slot != nullptr) {
+        reader.slot->epoch = globalEpoch.load();
+    }
+    else {
+        ++overflowReaders;
+    }
+}
+
+ReadSection::~ReadSection() {
+    if (--reader.depth != 0) {
+        return;
+    }
+
+    if (reader.slot != nullptr) {
+        reader.slot->epoch.store(0, std::memory_order_release);
+    }
+    else {
+        --overflowReaders;
+    }
+}
+
+uint64_t RetireEpoch() {
+    return globalEpoch.fetch_add(1);
+}
+
+uint64_t OldestReadEpoch() {
+    if (overflowReaders != 0) {
+        return 0;
+    }
+
+    uint64_t oldest = UINT64_MAX;
+    for (ReaderSlot& slot : slots) {
+        uint64_t epoch = slot.epoch;
+        if (epoch != 0 && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+
+    return oldest;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+
+// Epoch-based reclamation for read-mostly data. Writers publish a new version and retire the old one,
+// which is freed once every reader that could have seen it has left. Readers never wait
+
+// Marks the calling thread as a reader of published versions while alive. May be nested
+struct ReadSection {
+    ReadSection();
+    ~ReadSection();
+    ReadSection(const ReadSection&) = delete;
+    ReadSection& operator=(const ReadSection&) = delete;
+};
+
+// Writer calls it right after publishing. Old version is tagged with the result
+uint64_t RetireEpoch();
+// Versions retired with an epoch below it can't be seen by any reader anymore
+uint64_t OldestReadEpoch();
@@ -0,0 +1,444 @@
+// Console entry point for the authentication daemon and the offline tools. Built by CMake on Linux only
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "AuthServer.h"
+#include "Constants.h"
+#include "Encoding.h"
+#include "Metrics.h"
+#include "UserTransfer.h"
+#include "ShardedDatabase.h"
+
+namespace {
+    AuthServer* activeServer = nullptr;
+
+    void OnSignal(int) {
+        if (activeServer) {
+            activeServer->Stop();
+        }
+    }
+
+    const char* GetOption(int argc, char** argv, const char* name, const char* fallback) {
+        for (int i = 1; i + 1 < argc; ++i) {
+            if (strcmp(argv[i], name) == 0) {
+                return argv[i + 1];
+            }
+        }
+
+        return fallback;
+    }
+
+    // Serves database until SIGINT or SIGTERM, then saves it. Store is a Database or a ShardedDatabase
+    template<typename Store>
+    int Serve(Store& database, const char* databaseFile, const char* socketPath, const std::wstring& limitsFilename, size_t workers) {
+        if (database.isCorrupted) {
+            fprintf(stderr, "%s is damaged\n", databaseFile);
+            return 1;
+        }
+
+        RateLimiter limiter(limitsFilename.c_str());
+        AuthService auth(database, &limiter);
+        AuthServer server(auth, workers);
+        activeServer = &server;
+        signal(SIGINT, OnSignal);
+        signal(SIGTERM, OnSignal);
+        printf("Listening on %s with %zu workers\n", socketPath, server.workerCount);
+        // Metrics file is refreshed while serving, so scrapers see a running daemon
+        std::atomic<bool> isServing = true;
+        std::thread metricsWriter([&isServing]() {
+            auto next = std::chrono::steady_clock::now();
+            while (isServing) {
+                if (std::chrono::steady_clock::now() >= next) {
+                    WriteMetrics(kMetricsFile);
+                    next += std::chrono::milliseconds(kMetricsIntervalMs);
+                }
+
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+        });
+        bool isOk = server.Run(socketPath);
+        isServing = false;
+        metricsWriter.join();
+        activeServer = nullptr;
+        if (!isOk) {
+            fprintf(stderr, "Can't listen on %s\n", socketPath);
+            return 1;
+        }
+
+        bool isSaved = database.Save();
+        limiter.Save();
+        WriteMetrics(kMetricsFile);
+        if (!isSaved) {
+            // Changes are still in the journal and replayed on the next start
+            fprintf(stderr, "Can't write %s, changes stay in its journal\n", databaseFile);
+            return 1;
+        }
+
+        return 0;
+    }
+
+    // One shard is the plain database file. Other counts open the files --reshard wrote
+    int RunDaemon(const char* socketPath, const char* databaseFile, const char* limitsFile, size_t workers, size_t shards) {
+        std::wstring filename;
+        std::wstring limitsFilename;
+        if (!ReadUtf8(databaseFile, strlen(databaseFile), filename) || !ReadUtf8(limitsFile, strlen(limitsFile), limitsFilename)) {
+            fprintf(stderr, "Bad file path\n");
+            return 1;
+        }
+
+        if (shards == 0 || shards > kMaxShards) {
+            fprintf(stderr, "Shard count must be 1 to %zu\n", kMaxShards);
+            return 1;
+        }
+
+        if (shards > 1) {
+            ShardedDatabase database(filename.c_str(), shards);
+            return Serve(database, databaseFile, socketPath, limitsFilename, workers);
+        }
+
+        Database database(filename.c_str());
+        return Serve(database, databaseFile, socketPath, limitsFilename, workers);
+    }
+
+    int RunImport(const char* inputFile, const char* databaseFile) {
+        std::wstring input;
+        std::wstring filename;
+        if (!ReadUtf8(inputFile, strlen(inputFile), input) || !ReadUtf8(databaseFile, strlen(databaseFile), filename)) {
+            fprintf(stderr, "Bad file path\n");
+            return 1;
+        }
+
+        Database database(filename.c_str());
+        if (database.isCorrupted) {
+            fprintf(stderr, "%s is damaged\n", databaseFile);
+            return 1;
+        }
+
+        ImportReport report = ImportUsers(database, input.c_str());
+        if (!report.isOpened) {
+            fprintf(stderr, "Can't open %s\n", inputFile);
+            return 1;
+        }
+
+        for (const std::string& error : report.errors) {
+            fprintf(stderr, "%s\n", error.c_str());
+        }
+
+        printf("imported: %zu, duplicates: %zu, invalid: %zu\n", report.imported, report.duplicates, report.invalid);
+        printf("throughput: %.1f users/s\n", (report.imported + report.duplicates + report.invalid) / std::max(report.seconds, 1e-9));
+        return 0;
+    }
+
+    int RunExport(const char* outputFile, const char* databaseFile) {
+        std::wstring output;
+        std::wstring filename;
+        if (!ReadUtf8(outputFile, strlen(outputFile), output) || !ReadUtf8(databaseFile, strlen(databaseFile), filename)) {
+            fprintf(stderr, "Bad file path\n");
+            return 1;
+        }
+
+        Database database(filename.c_str());
+        if (database.isCorrupted) {
+            fprintf(stderr, "%s is damaged\n", databaseFile);
+            return 1;
+        }
+
+        size_t exported = 0;
+        auto start = std::chrono::steady_clock::now();
+        if (!ExportUsers(database, output.c_str(), exported)) {
+            fprintf(stderr, "Can't write %s\n", outputFile);
+            return 1;
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("exported: %zu\n", exported);
+        printf("throughput: %.1f users/s\n", exported / std::max(seconds, 1e-9));
+        return 0;
+    }
+
+    int RunReshard(const char* databaseFile, size_t sourceShards, size_t targetShards) {
+        std::wstring filename;
+        if (!ReadUtf8(databaseFile, strlen(databaseFile), filename)) {
+            fprintf(stderr, "Bad file path\n");
+            return 1;
+        }
+
+        if (sourceShards == 0 || sourceShards > kMaxShards || targetShards == 0 || targetShards > kMaxShards) {
+            fprintf(stderr, "Shard count must be 1 to %zu\n", kMaxShards);
+            return 1;
+        }
+
+        size_t copied;
+        auto start = std::chrono::steady_clock::now();
+        if (!ReshardUsers(filename.c_str(), sourceShards, filename.c_str(), targetShards, copied)) {
+            fprintf(stderr, "%s is missing, damaged, already has %zu shards or they can't be written\n", databaseFile, targetShards);
+            return 1;
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("copied: %zu users into %zu shards\n", copied, targetShards);
+        printf("throughput: %.1f users/s\n", copied / std::max(seconds, 1e-9));
+        return 0;
+    }
+
+    // Writers on different threads change users of random shards
+    int RunShardBench(const char* databaseFile, size_t shards, int threads, int iterations) {
+        std::wstring filename;
+        if (!ReadUtf8(databaseFile, strlen(databaseFile), filename)) {
+            fprintf(stderr, "Bad file path\n");
+            return 1;
+        }
+
+        if (shards == 0 || shards > kMaxShards) {
+            fprintf(stderr, "Shard count must be 1 to %zu\n", kMaxShards);
+            return 1;
+        }
+
+        ShardedDatabase database(filename.c_str(), shards);
+        std::vector<User> users;
+        for (int i = 0; i < threads * 64; ++i) {
+            users.push_back(User(L"shardbench" + std::to_wstring(i), L"", false, false));
+        }
+
+        database.AddUsers(users);
+        std::vector<UserId> ids;
+        for (const User& user : users) {
+            ids.push_back(database.Find(user.username));
+        }
+
+        std::vector<std::thread> workers;
+        auto start = std::chrono::steady_clock::now();
+        for (int thread = 0; thread < threads; ++thread) {
+            workers.emplace_back([&database, &ids, thread, iterations]() {
+                for (int i = 0; i < iterations; ++i) {
+                    database.SetRestrictionEnabled(ids[(thread * 64 + i) % ids.size()], (i & 1) != 0);
+                }
+            });
+        }
+
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (!database.Save()) {
+            fprintf(stderr, "Can't write %s\n", databaseFile);
+        }
+
+        printf("shards: %zu, threads: %d\n", shards, threads);
+        printf("throughput: %.1f mutations/s\n", (double)threads * iterations / std::max(seconds, 1e-9));
+        return 0;
+    }
+
+    int Connect(const char* socketPath) {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd != -1 && connect(fd, (const sockaddr*)&address, sizeof(address)) != 0) {
+            close(fd);
+            return -1;
+        }
+
+        return fd;
+    }
+
+    // Sends one line and waits for one line back
+    bool Exchange(int fd, const std::string& request, std::string& response) {
+        if (send(fd, request.data(), request.length(), MSG_NOSIGNAL) != (ssize_t)request.length()) {
+            return false;
+        }
+
+        response.clear();
+        char ch;
+        while (recv(fd, &ch, 1, 0) == 1) {
+            if (ch == '\n') {
+                return true;
+            }
+
+            response.push_back(ch);
+        }
+
+        return false;
+    }
+
+    // Load generator: every client logs in repeatedly as the same user
+    int RunBench(const char* socketPath, const char* username, const char* password, int clients, int requests) {
+        std::vector<std::vector<double>> latencies(clients);
+        std::vector<int> failures(clients, 0);
+        std::vector<std::thread> threads;
+        auto start = std::chrono::steady_clock::now();
+        for (int client = 0; client < clients; ++client) {
+            threads.emplace_back([&, client]() {
+                int fd = Connect(socketPath);
+                std::string response;
+                if (fd == -1 || !Exchange(fd, "HANDSHAKE\n", response) || response.compare(0, 3, "OK\t") != 0) {
+                    failures[client] = requests;
+                    return;
+                }
+
+                int handshake = atoi(response.c_str() + 3);
+                std::string token = response.substr(response.find('\t', 3) + 1);
+                std::string login = std::string("LOGIN\t") + username + "\t" + password + "\t" + token + "\t" + std::to_string(handshake * handshake + 3) + "\n";
+                for (int i = 0; i < requests; ++i) {
+                    auto begin = std::chrono::steady_clock::now();
+                    if (!Exchange(fd, login, response) || response != "OK") {
+                        ++failures[client];
+                        continue;
+                    }
+
+                    latencies[client].push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+                }
+
+                close(fd);
+            });
+        }
+
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::vector<double> all;
+        int failed = 0;
+        for (int client = 0; client < clients; ++client) {
+            all.insert(all.end(), latencies[client].begin(), latencies[client].end());
+            failed += failures[client];
+        }
+
+        if (all.empty()) {
+            fprintf(stderr, "No successful requests, %d failed\n", failed);
+            return 1;
+        }
+
+        std::sort(all.begin(), all.end());
+        printf("requests: %zu ok, %d failed\n", all.size(), failed);
+        printf("p50: %.2f ms\np99: %.2f ms\n", all[all.size() / 2], all[std::min(all.size() - 1, all.size() * 99 / 100)]);
+        printf("throughput: %.1f req/s\n", all.size() / seconds);
+        return 0;
+    }
+
+    // Every thread checks the same few usernames, so slots are contended. Most checks are rejections
+    int RunLimiterBench(int threadCount, int iterations) {
+        RateLimiter limiter(L"");
+        const wchar_t* usernames[] = { L"ADMIN", L"alice", L"bob", L"eve" };
+        std::atomic<uint64_t> allowed = 0;
+        std::vector<std::thread> threads;
+        auto start = std::chrono::steady_clock::now();
+        for (int thread = 0; thread < threadCount; ++thread) {
+            threads.emplace_back([&, thread]() {
+                uint64_t count = 0;
+                for (int i = 0; i < iterations; ++i) {
+                    count += limiter.TryAcquireUser(usernames[(i + thread) & 3]);
+                }
+
+                allowed += count;
+            });
+        }
+
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double checks = (double)threadCount * iterations;
+        printf("checks: %.0f, allowed: %llu\n", checks, (unsigned long long)allowed.load());
+        printf("throughput: %.1f M checks/s\n", checks / seconds / 1e6);
+        return 0;
+    }
+
+    // Issues challenges, encodes, decodes and verifies them on one thread
+    int RunChallengeBench(int iterations) {
+        ChallengeService challenges;
+        auto start = std::chrono::steady_clock::now();
+        int verified = 0;
+        for (int i = 0; i < iterations; ++i) {
+            ChallengeToken token = challenges.Issue();
+            verified += challenges.Verify(token, (int64_t)token.input * token.input + 3);
+        }
+
+        double issueSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::string text = EncodeToken(challenges.Issue());
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            ChallengeToken token;
+            verified += DecodeToken(text, token) && challenges.Verify(token, -1);
+        }
+
+        double verifySeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("verified: %d of %d\n", verified, iterations);
+        printf("issue + verify: %.2f M/s\n", iterations / issueSeconds / 1e6);
+        printf("decode + verify: %.2f M/s\n", iterations / verifySeconds / 1e6);
+        return 0;
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc >= 3 && strcmp(argv[1], "--server") == 0) {
+        char* end;
+        return RunDaemon(argv[2], GetOption(argc, argv, "--database", "users.dat"), GetOption(argc, argv, "--limits", "ratelimit.dat"),
+            strtoul(GetOption(argc, argv, "--workers", "0"), &end, 10), strtoul(GetOption(argc, argv, "--shards", "1"), &end, 10));
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "--import") == 0) {
+        return RunImport(argv[2], GetOption(argc, argv, "--database", "users.dat"));
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "--export") == 0) {
+        return RunExport(argv[2], GetOption(argc, argv, "--database", "users.dat"));
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "--reshard") == 0) {
+        size_t targetShards = strtoul(argv[2], nullptr, 10);
+        size_t sourceShards = strtoul(GetOption(argc, argv, "--from", "1"), nullptr, 10);
+        return RunReshard(GetOption(argc, argv, "--database", "users.dat"), sourceShards, targetShards);
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--bench-shards") == 0) {
+        size_t shards = strtoul(GetOption(argc, argv, "--shards", "8"), nullptr, 10);
+        int threads = std::max(1, atoi(GetOption(argc, argv, "--threads", "8")));
+        int iterations = std::max(1, atoi(GetOption(argc, argv, "--iterations", "1000")));
+        return RunShardBench(GetOption(argc, argv, "--database", "shardbench.dat"), shards, threads, iterations);
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--bench-challenge") == 0) {
+        return RunChallengeBench(std::max(1, atoi(GetOption(argc, argv, "--iterations", "1000000"))));
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--bench-limiter") == 0) {
+        int threads = std::max(1, atoi(GetOption(argc, argv, "--threads", "8")));
+        int iterations = std::max(1, atoi(GetOption(argc, argv, "--iterations", "10000000")));
+        return RunLimiterBench(threads, iterations);
+    }
+
+    if (argc >= 5 && strcmp(argv[1], "--bench") == 0) {
+        int clients = std::max(1, atoi(GetOption(argc, argv, "--clients", "8")));
+        int requests = std::max(1, atoi(GetOption(argc, argv, "--requests", "10")));
+        return RunBench(argv[2], argv[3], argv[4], clients, requests);
+    }
+
+    fprintf(stderr,
+        "Usage:\n"
+        "  %s --server <socket> [--database users.dat] [--limits ratelimit.dat] [--workers N] [--shards 1]\n"
+        "  %s --import <users.csv|users.jsonl> [--database users.dat]\n"
+        "  %s --export <users.csv|users.jsonl> [--database users.dat]\n"
+        "  %s --reshard <shards> [--from 1] [--database users.dat]\n"
+        "  %s --bench <socket> <username> <password> [--clients N] [--requests N]\n"
+        "  %s --bench-limiter [--threads N] [--iterations N]\n"
+        "  %s --bench-challenge [--iterations N]\n"
+        "  %s --bench-shards [--shards N] [--threads N] [--iterations N] [--database shardbench.dat]\n",
+        argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+    return 1;
+}
@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+#include "SessionService.h"
+
+namespace {
+    uint64_t NowMs() {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    struct RandomKey {
+        RandomKey() {
+            std::random_device device;
+            for (uint8_t& byte : bytes) {
+                byte = (uint8_t)device();
+            }
+        }
+
+        uint8_t bytes[kSipHashKeySize];
+    };
+
+    uint64_t Load64(const uint8_t* data) {
+        uint64_t value = 0;
+        for (int i = 0; i < 8; ++i) {
+            value |= (uint64_t)data[i] << (8 * i);
+        }
+
+        return value;
+    }
+}
+
+SessionService::SessionService()
+    : random(RandomKey().bytes), issued(0), stripes(new Stripe[kSessionStripes]), generations(new std::atomic<std::atomic<uint32_t>*>[kSessionGenerationBlocks]()) {}
+
+SessionService::~SessionService() {
+    for (size_t i = 0; i < kSessionGenerationBlocks; ++i) {
+        delete[] generations[i].load();
+    }
+}
+
+SessionToken SessionService::Issue(UserId user) {
+    uint64_t counter = issued.fetch_add(1, std::memory_order_relaxed);
+    uint8_t bytes[kSipHash128Size];
+    random.Sign(&counter, sizeof(counter), bytes);
+    SessionToken token = { Load64(bytes), Load64(bytes + 8) };
+    uint64_t now = NowMs();
+    Session session = { token.secret, user, GetGeneration(user), now + kSessionLifetimeMs };
+    Stripe& stripe = stripes[token.id & (kSessionStripes - 1)];
+    std::lock_guard<std::mutex> guard(stripe.lock);
+    if (stripe.sessions.size() >= stripe.sweepSize) {
+        std::erase_if(stripe.sessions, [this, now](const auto& entry) { return !IsAlive(entry.second, now); });
+        stripe.sweepSize = std::max(kSessionSweepSize, stripe.sessions.size() * 2);
+    }
+
+    stripe.sessions[token.id] = session;
+    return token;
+}
+
+bool SessionService::Validate(const SessionToken& token, UserId& user) {
+    Stripe& stripe = stripes[token.id & (kSessionStripes - 1)];
+    std::lock_guard<std::mutex> guard(stripe.lock);
+    auto it = stripe.sessions.find(token.id);
+    if (it == stripe.sessions.end() || it->second.secret != token.secret) {
+        return false;
+    }
+
+    uint64_t now = NowMs();
+    if (!IsAlive(it->second, now)) {
+        stripe.sessions.erase(it);
+        return false;
+    }
+
+    // Sliding expiry, a session in use doesn't end under its user
+    it->second.expires = now + kSessionLifetimeMs;
+    user = it->second.user;
+    return true;
+}
+
+void SessionService::Revoke(const SessionToken& token) {
+    Stripe& stripe = stripes[token.id & (kSessionStripes - 1)];
+    std::lock_guard<std::mutex> guard(stripe.lock);
+    auto it = stripe.sessions.find(token.id);
+    if (it != stripe.sessions.end() && it->second.secret == token.secret) {
+        stripe.sessions.erase(it);
+    }
+}
+
+void SessionService::RevokeUser(UserId user) {
+    std::atomic<std::atomic<uint32_t>*>& slot = generations[user / kSessionGenerationBlock];
+    std::atomic<uint32_t>* block = slot.load(std::memory_order_acquire);
+    if (block == nullptr) {
+        std::lock_guard<std::mutex> guard(generationLock);
+        block = slot.load(std::memory_order_acquire);
+        if (block == nullptr) {
+            block = new std::atomic<uint32_t>[kSessionGenerationBlock]();
+            slot.store(block, std::memory_order_release);
+        }
+    }
+
+    block[user % kSessionGenerationBlock].fetch_add(1, std::memory_order_acq_rel);
+}
+
+bool SessionService::IsAlive(const Session& session, uint64_t now) const {
+    return session.expires > now && session.generation == GetGeneration(session.user);
+}
+
+uint32_t SessionService::GetGeneration(UserId user) const {
+    std::atomic<uint32_t>* block = generations[user / kSessionGenerationBlock].load(std::memory_order_acquire);
+    return block == nullptr ? 0 : block[user % kSessionGenerationBlock].load(std::memory_order_acquire);
+}
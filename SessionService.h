@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
+
+#include "UserStore.h"
+#include "SipHash.h"
+
+// Session ends after this long without a successful Validate
+constexpr uint64_t kSessionLifetimeMs = 30 * 60 * 1000;
+// Power of two. Sessions of different stripes never contend
+constexpr size_t kSessionStripes = 64;
+// Power of two. Generations are allocated for this many consecutive ids at once, on the first revocation among them
+constexpr size_t kSessionGenerationBlock = 65536;
+constexpr size_t kSessionGenerationBlocks = ((size_t)UINT32_MAX + 1) / kSessionGenerationBlock;
+// Stripe drops dead sessions when it grows past this, then past twice its size after the sweep
+constexpr size_t kSessionSweepSize = 64;
+
+// Opaque, 128 random bits. Only the issuing service can check it
+struct SessionToken {
+    uint64_t id;
+    uint64_t secret;
+};
+
+// Sessions of logged in users, so actions after the login prove who makes them without the password.
+// Hash table is split into stripes with a lock each. Thread-safe
+struct SessionService {
+    // Tokens come from a random key, so they don't survive a restart
+    SessionService();
+    SessionService(const SessionService& other) = delete;
+    ~SessionService();
+
+    SessionToken Issue(UserId user);
+    // Returns false if token is unknown, expired or revoked. Otherwise extends the session by kSessionLifetimeMs. Doesn't allocate
+    bool Validate(const SessionToken& token, UserId& user);
+    // Ends one session
+    void Revoke(const SessionToken& token);
+    // Ends every session of user at once without visiting them. Validate drops them later
+    void RevokeUser(UserId user);
+
+private:
+    struct Session {
+        uint64_t secret;
+        UserId user;
+        // Of the user at issue. RevokeUser increments it
+        uint32_t generation;
+        // Milliseconds of the steady clock, moved forward by every Validate
+        uint64_t expires;
+    };
+
+    struct alignas(64) Stripe {
+        std::mutex lock;
+        std::unordered_map<uint64_t, Session> sessions;
+        size_t sweepSize = kSessionSweepSize;
+    };
+
+    bool IsAlive(const Session& session, uint64_t now) const;
+    // Users never revoked are at generation 0
+    uint32_t GetGeneration(UserId user) const;
+
+    // Tokens are the PRF of a counter
+    SipHash128 random;
+    std::atomic<uint64_t> issued;
+    std::unique_ptr<Stripe[]> stripes;
+    // Generation of every user, blocks are null until a user in them is revoked. Readers don't lock
+    std::unique_ptr<std::atomic<std::atomic<uint32_t>*>[]> generations;
+    // Serializes allocation of blocks
+    std::mutex generationLock;
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+constexpr size_t kSha256Size = 32;
+constexpr size_t kSha256BlockSize = 64;
+
+struct Sha256 {
+    Sha256();
+
+    void Update(const void* data, size_t size);
+    void Final(uint8_t (&digest)[kSha256Size]);
+
+    uint32_t state[8];
+    uint8_t block[kSha256BlockSize];
+    size_t blockSize;
+    uint64_t length;
+};
+
+// HMAC-SHA256 with the key pads hashed once, so the same key can sign many messages cheaply
+struct HmacSha256 {
+    HmacSha256(const void* key, size_t keySize);
+
+    void Sign(const void* data, size_t size, uint8_t (&mac)[kSha256Size]) const;
+
+    Sha256 inner;
+    Sha256 outer;
+};
+
+// Compares in time independent of where buffers differ
+bool ConstantTimeEqual(const uint8_t* left, const uint8_t* right, size_t size);
@@ -0,0 +1,285 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <filesystem>
+#include <thread>
+
+#include "ShardedDatabase.h"
+#include "Constants.h"
+
+namespace {
+    // Independent of the hash the shard index uses, so users of one shard still spread over its index
+    uint64_t HashShard(std::wstring_view username) {
+        uint64_t hash = 14695981039346656037ull;
+        for (wchar_t ch : username) {
+            hash ^= (uint64_t)ch;
+            hash *= 1099511628211ull;
+        }
+
+        // MurmurHash3 finalizer
+        hash ^= hash >> 33;
+        hash *= 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 33;
+        hash *= 0xC4CEB9FE1A85EC53ull;
+        hash ^= hash >> 33;
+        return hash;
+    }
+
+    // Runs task(shard) for every shard on its own thread
+    template<typename Task>
+    void ForEachShard(size_t shardCount, Task task) {
+        if (shardCount == 1) {
+            task(0);
+            return;
+        }
+
+        std::vector<std::thread> threads;
+        for (size_t shard = 0; shard < shardCount; ++shard) {
+            threads.emplace_back([&task, shard]() { task(shard); });
+        }
+
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+
+    // Snapshot or journal of filename is on disk
+    bool HasFiles(const std::wstring& filename) {
+        return std::filesystem::exists(filename) || std::filesystem::exists(filename + L".log");
+    }
+
+    // Users read from a source database, with hashes instead of passwords
+    template<typename Source>
+    void CopyUsers(const Source& source, ShardedDatabase& target, size_t& copied) {
+        std::vector<User> batch;
+        size_t userCount = source.UserCount();
+        for (size_t i = 0; i < userCount; ++i) {
+            UserId id = (UserId)i;
+            User user;
+            user.username = source.GetUsername(id);
+            user.passwordHash = source.GetPasswordHash(id);
+            user.isBlocked = source.IsBlocked(id);
+            user.isRestrictionEnabled = source.IsRestrictionEnabled(id);
+            batch.push_back(std::move(user));
+            if (batch.size() == kReshardBatchSize) {
+                target.AddUsers(batch);
+                copied += batch.size();
+                batch.clear();
+            }
+        }
+
+        target.AddUsers(batch);
+        copied += batch.size();
+    }
+}
+
+ShardedDatabase::ShardedDatabase(const wchar_t* filename, size_t shardCount, bool withAdmin, bool isReadOnly)
+    : isCorrupted(false) {
+    assert(shardCount >= 1 && shardCount <= kMaxShards);
+    for (size_t shard = 0; shard < shardCount; ++shard) {
+        filenames.push_back(GetShardFilename(filename, shard, shardCount));
+    }
+
+    shards.resize(shardCount);
+    ForEachShard(shardCount, [this, isReadOnly, shardCount](size_t shard) {
+        shards[shard] = std::make_unique<Database>(filenames[shard].c_str(), false, isReadOnly);
+        // Number of local ids l with l * shardCount + shard < kInvalidUser
+        shards[shard]->maxUsers = (kInvalidUser - 1 - shard) / shardCount + 1;
+    });
+
+    for (const std::unique_ptr<Database>& shard : shards) {
+        isCorrupted = isCorrupted || shard->isCorrupted;
+    }
+
+    if (withAdmin && !isCorrupted && Find(kAdminUsername) == kInvalidUser) {
+        AddUser(User(kAdminUsername, L"", false, false));
+    }
+}
+
+std::wstring ShardedDatabase::GetShardFilename(const wchar_t* filename, size_t shard, size_t shardCount) {
+    return std::wstring(filename) + L"." + std::to_wstring(shard) + L"-of-" + std::to_wstring(shardCount);
+}
+
+size_t ShardedDatabase::GetShard(std::wstring_view username) const {
+    // Multiply-shift instead of modulo, high bits of the hash are the best mixed
+    return (size_t)(((HashShard(username) >> 32) * shards.size()) >> 32);
+}
+
+Database& ShardedDatabase::GetShardDatabase(size_t shard) {
+    return *shards[shard];
+}
+
+bool ShardedDatabase::Save() {
+    // Clean shards return at once
+    std::atomic<bool> isSaved(true);
+    ForEachShard(shards.size(), [this, &isSaved](size_t shard) {
+        if (!shards[shard]->Save()) {
+            isSaved = false;
+        }
+    });
+
+    return isSaved;
+}
+
+void ShardedDatabase::Flush() {
+    ForEachShard(shards.size(), [this](size_t shard) {
+        shards[shard]->Flush();
+    });
+}
+
+UserId ShardedDatabase::Find(std::wstring_view username) const {
+    size_t shard = GetShard(username);
+    UserId id = shards[shard]->Find(username);
+    return id == kInvalidUser ? kInvalidUser : ToGlobal(shard, id);
+}
+
+UserId ShardedDatabase::AddUser(const User& user) {
+    size_t shard = GetShard(user.username);
+    UserId id = shards[shard]->AddUser(user);
+    return id == kInvalidUser ? kInvalidUser : ToGlobal(shard, id);
+}
+
+std::vector<UserId> ShardedDatabase::AddUsers(const std::vector<User>& users) {
+    std::vector<std::vector<User>> batches(shards.size());
+    // Position of every user in its shard batch
+    std::vector<std::pair<size_t, size_t>> positions;
+    positions.reserve(users.size());
+    for (const User& user : users) {
+        size_t shard = GetShard(user.username);
+        positions.emplace_back(shard, batches[shard].size());
+        batches[shard].push_back(user);
+    }
+
+    std::vector<std::vector<UserId>> added(shards.size());
+    ForEachShard(shards.size(), [this, &batches, &added](size_t shard) {
+        if (!batches[shard].empty()) {
+            added[shard] = shards[shard]->AddUsers(batches[shard]);
+        }
+    });
+
+    std::vector<UserId> ids;
+    ids.reserve(users.size());
+    for (const std::pair<size_t, size_t>& position : positions) {
+        UserId id = added[position.first][position.second];
+        ids.push_back(id == kInvalidUser ? kInvalidUser : ToGlobal(position.first, id));
+    }
+
+    return ids;
+}
+
+void ShardedDatabase::SetPassword(UserId id, std::wstring_view password) {
+    ShardOf(id).SetPassword(ToLocal(id), password);
+}
+
+bool ShardedDatabase::SetInitialPassword(UserId id, std::wstring_view password) {
+    return ShardOf(id).SetInitialPassword(ToLocal(id), password);
+}
+
+void ShardedDatabase::SetPasswordHash(UserId id, const PasswordHash& passwordHash) {
+    ShardOf(id).SetPasswordHash(ToLocal(id), passwordHash);
+}
+
+void ShardedDatabase::SetBlocked(UserId id, bool isBlocked) {
+    ShardOf(id).SetBlocked(ToLocal(id), isBlocked);
+}
+
+void ShardedDatabase::SetRestrictionEnabled(UserId id, bool isRestrictionEnabled) {
+    ShardOf(id).SetRestrictionEnabled(ToLocal(id), isRestrictionEnabled);
+}
+
+size_t ShardedDatabase::UserCount() const {
+    size_t count = 0;
+    for (const std::unique_ptr<Database>& shard : shards) {
+        count += shard->UserCount();
+    }
+
+    return count;
+}
+
+std::wstring_view ShardedDatabase::GetUsername(UserId id) const {
+    return ShardOf(id).GetUsername(ToLocal(id));
+}
+
+PasswordHash ShardedDatabase::GetPasswordHash(UserId id) const {
+    return ShardOf(id).GetPasswordHash(ToLocal(id));
+}
+
+bool ShardedDatabase::HasPassword(UserId id) const {
+    return ShardOf(id).HasPassword(ToLocal(id));
+}
+
+bool ShardedDatabase::VerifyPassword(UserId id, std::wstring_view password) const {
+    return ShardOf(id).VerifyPassword(ToLocal(id), password);
+}
+
+bool ShardedDatabase::IsBlocked(UserId id) const {
+    return ShardOf(id).IsBlocked(ToLocal(id));
+}
+
+bool ShardedDatabase::IsRestrictionEnabled(UserId id) const {
+    return ShardOf(id).IsRestrictionEnabled(ToLocal(id));
+}
+
+UserId ShardedDatabase::ToGlobal(size_t shard, UserId id) const {
+    return (UserId)(id * shards.size() + shard);
+}
+
+Database& ShardedDatabase::ShardOf(UserId id) const {
+    return *shards[id % shards.size()];
+}
+
+UserId ShardedDatabase::ToLocal(UserId id) const {
+    return (UserId)(id / shards.size());
+}
+
+bool ReshardUsers(const wchar_t* source, size_t sourceShards, const wchar_t* target, size_t targetShards, size_t& copied) {
+    copied = 0;
+    if (sourceShards == 0 || sourceShards > kMaxShards || targetShards == 0 || targetShards > kMaxShards) {
+        return false;
+    }
+
+    for (size_t shard = 0; shard < targetShards; ++shard) {
+        if (HasFiles(ShardedDatabase::GetShardFilename(target, shard, targetShards))) {
+            return false;
+        }
+    }
+
+    // Missing source would open empty and leave an empty target behind. Shards without users may have no files
+    bool hasSource = false;
+    if (sourceShards == 1) {
+        hasSource = HasFiles(source);
+    }
+    else {
+        for (size_t shard = 0; shard < sourceShards; ++shard) {
+            hasSource = hasSource || HasFiles(ShardedDatabase::GetShardFilename(source, shard, sourceShards));
+        }
+    }
+
+    if (!hasSource) {
+        return false;
+    }
+
+    // Admin comes from the source with its password
+    ShardedDatabase shardedTarget(target, targetShards, false);
+    if (sourceShards == 1) {
+        Database database(source, false, true);
+        if (database.isCorrupted) {
+            return false;
+        }
+
+        CopyUsers(database, shardedTarget, copied);
+    }
+    else {
+        ShardedDatabase database(source, sourceShards, false, true);
+        if (database.isCorrupted) {
+            return false;
+        }
+
+        // Global ids of a sharded source aren't dense, so walk its shards
+        for (size_t shard = 0; shard < sourceShards; ++shard) {
+            CopyUsers(database.GetShardDatabase(shard), shardedTarget, copied);
+        }
+    }
+
+    return shardedTarget.Save();
+}
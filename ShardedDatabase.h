@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+
+#include "Database.h"
+
+constexpr size_t kMaxShards = 256;
+// Users copied into the target at once while resharding
+constexpr size_t kReshardBatchSize = 65536;
+
+// Users split by username hash over shardCount independent databases. Every shard has its own file, journal,
+// index and writer lock, so mutations of users in different shards run in parallel and Save rewrites only
+// shards that changed. Shard files are named <filename>.<shard>-of-<shardCount>, so opening with another count
+// finds no files instead of misrouting users.
+// Ids are local id * shardCount + shard, shards refuse users whose id would reach kInvalidUser
+struct ShardedDatabase final : UserStore {
+    // Creates the admin user in its shard if it's missing, unless withAdmin is false. Read-only shards never write to disk.
+    // shardCount must be 1 to kMaxShards
+    ShardedDatabase(const wchar_t* filename, size_t shardCount, bool withAdmin = true, bool isReadOnly = false);
+    ShardedDatabase(const ShardedDatabase& other) = delete;
+
+    static std::wstring GetShardFilename(const wchar_t* filename, size_t shard, size_t shardCount);
+    size_t GetShard(std::wstring_view username) const;
+    Database& GetShardDatabase(size_t shard);
+
+    // Saves shards with changes, each in its own thread. Returns false if any shard couldn't be written
+    bool Save();
+    // Shards sync their journals in parallel
+    void Flush() override;
+    UserId Find(std::wstring_view username) const override;
+    UserId AddUser(const User& user) override;
+    // Batch is split by shard and shards are filled in parallel
+    std::vector<UserId> AddUsers(const std::vector<User>& users);
+    void SetPassword(UserId id, std::wstring_view password) override;
+    bool SetInitialPassword(UserId id, std::wstring_view password) override;
+    void SetPasswordHash(UserId id, const PasswordHash& passwordHash);
+    void SetBlocked(UserId id, bool isBlocked) override;
+    void SetRestrictionEnabled(UserId id, bool isRestrictionEnabled) override;
+
+    size_t UserCount() const;
+    std::wstring_view GetUsername(UserId id) const override;
+    PasswordHash GetPasswordHash(UserId id) const;
+    bool HasPassword(UserId id) const override;
+    bool VerifyPassword(UserId id, std::wstring_view password) const override;
+    bool IsBlocked(UserId id) const override;
+    bool IsRestrictionEnabled(UserId id) const override;
+
+    // Any shard failed validation on open. Nothing is written then
+    bool isCorrupted;
+
+private:
+    UserId ToGlobal(size_t shard, UserId id) const;
+    Database& ShardOf(UserId id) const;
+    UserId ToLocal(UserId id) const;
+
+    // Shards keep pointers to their filenames
+    std::vector<std::wstring> filenames;
+    std::vector<std::unique_ptr<Database>> shards;
+};
+
+// Copies every user of source (a plain database if sourceShards is 1) into targetShards new shard files.
+// Password hashes are copied as is and source files are only read. Returns false if a shard count is out of 1 to kMaxShards,
+// source has no files or is damaged, any target file already exists or the target couldn't be saved
+bool ReshardUsers(const wchar_t* source, size_t sourceShards, const wchar_t* target, size_t targetShards, size_t& copied);
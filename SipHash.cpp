@@ -0,0 +1,113 @@
+#include "SipHash.h"
+
+namespace {
+    uint64_t Rotate(uint64_t x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    uint64_t Load64(const uint8_t* data) {
+        uint64_t value = 0;
+        for (int i = 0; i < 8; ++i) {
+            value |= (uint64_t)data[i] << (8 * i);
+        }
+
+        return value;
+    }
+
+    void Store64(uint8_t* data, uint64_t value) {
+        for (int i = 0; i < 8; ++i) {
+            data[i] = (uint8_t)(value >> (8 * i));
+        }
+    }
+
+    void Round(uint64_t (&v)[4]) {
+        v[0] += v[1];
+        v[1] = Rotate(v[1], 13);
+        v[1] ^= v[0];
+        v[0] = Rotate(v[0], 32);
+        v[2] += v[3];
+        v[3] = Rotate(v[3], 16);
+        v[3] ^= v[2];
+        v[0] += v[3];
+        v[3] = Rotate(v[3], 21);
+        v[3] ^= v[0];
+        v[2] += v[1];
+        v[1] = Rotate(v[1], 17);
+        v[1] ^= v[2];
+        v[2] = Rotate(v[2], 32);
+    }
+
+    // Rounds per 8-byte word, the last word carries the message length in the top byte
+    template<int rounds>
+    void Absorb(uint64_t (&v)[4], const uint8_t* bytes, size_t size) {
+        const uint8_t* end = bytes + (size & ~(size_t)7);
+        for (; bytes != end; bytes += 8) {
+            uint64_t m = Load64(bytes);
+            v[3] ^= m;
+            for (int i = 0; i < rounds; ++i) {
+                Round(v);
+            }
+
+            v[0] ^= m;
+        }
+
+        uint64_t last = (uint64_t)size << 56;
+        for (size_t i = 0; i < (size & 7); ++i) {
+            last |= (uint64_t)bytes[i] << (8 * i);
+        }
+
+        v[3] ^= last;
+        for (int i = 0; i < rounds; ++i) {
+            Round(v);
+        }
+
+        v[0] ^= last;
+    }
+}
+
+SipHash128::SipHash128(const uint8_t (&key)[kSipHashKeySize])
+    : k0(Load64(key)), k1(Load64(key + 8)) {}
+
+void SipHash128::Sign(const void* data, size_t size, uint8_t (&mac)[kSipHash128Size]) const {
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint64_t v[4] = {
+        k0 ^ 0x736F6D6570736575ull,
+        k1 ^ 0x646F72616E646F6Dull ^ 0xEE,
+        k0 ^ 0x6C7967656E657261ull,
+        k1 ^ 0x7465646279746573ull
+    };
+
+    Absorb<2>(v, bytes, size);
+    v[2] ^= 0xEE;
+    for (int i = 0; i < 4; ++i) {
+        Round(v);
+    }
+
+    Store64(mac, v[0] ^ v[1] ^ v[2] ^ v[3]);
+    v[1] ^= 0xDD;
+    for (int i = 0; i < 4; ++i) {
+        Round(v);
+    }
+
+    Store64(mac + 8, v[0] ^ v[1] ^ v[2] ^ v[3]);
+}
+
+SipHash64::SipHash64(const uint8_t (&key)[kSipHashKeySize])
+    : k0(Load64(key)), k1(Load64(key + 8)) {}
+
+uint64_t SipHash64::Hash(const void* data, size_t size) const {
+    uint64_t v[4] = {
+        k0 ^ 0x736F6D6570736575ull,
+        k1 ^ 0x646F72616E646F6Dull,
+        k0 ^ 0x6C7967656E657261ull,
+        k1 ^ 0x7465646279746573ull
+    };
+
+    Absorb<1>(v, (const uint8_t*)data, size);
+    v[2] ^= 0xFF;
+    for (int i = 0; i < 3; ++i) {
+        Round(v);
+    }
+
+    return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+constexpr size_t kSipHashKeySize = 16;
+constexpr size_t kSipHash128Size = 16;
+
+// SipHash-2-4 with 128-bit output. Keyed PRF for short messages, an order of magnitude cheaper than HMAC-SHA256
+struct SipHash128 {
+    SipHash128(const uint8_t (&key)[kSipHashKeySize]);
+
+    void Sign(const void* data, size_t size, uint8_t (&mac)[kSipHash128Size]) const;
+
+    uint64_t k0;
+    uint64_t k1;
+};
+
+// SipHash-1-3 with 64-bit output, the lighter variant for hash tables. Keys from untrusted input can't be picked to collide without the key
+struct SipHash64 {
+    SipHash64(const uint8_t (&key)[kSipHashKeySize]);
+
+    uint64_t Hash(const void* data, size_t size) const;
+
+    uint64_t k0;
+    uint64_t k1;
+};
@@ -0,0 +1,141 @@
+// Readers run Find, GetUsername and IsBlocked while one writer adds and blocks users.
+// Any torn read, a name of another user or a flag of a user the writer never touches, fails the test.
+// Users fill more than one page of chunks and split order pages and groups, the username order is checked at the end.
+// Build with PR2_SANITIZE_THREAD=ON to run it under ThreadSanitizer
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Database.h"
+
+namespace {
+    constexpr size_t kUsers = kChunkUsers * kChunkPageSize + 4 * kChunkUsers;
+    static_assert(kUsers > 20000 && kUsers < 100000);
+    constexpr size_t kReaders = 4;
+    constexpr size_t kBlockEvery = 4;
+
+    std::wstring Username(size_t id) {
+        return L"user" + std::to_wstring(id);
+    }
+
+    // Returns number of inconsistencies seen
+    size_t Read(const Database& database, const std::atomic<bool>& isWriting, unsigned seed) {
+        std::mt19937 random(seed);
+        size_t errors = 0;
+        size_t lastCount = 0;
+        do {
+            size_t count = database.UserCount();
+            if (count < lastCount) {
+                ++errors;
+            }
+
+            lastCount = count;
+            if (count == 0) {
+                continue;
+            }
+
+            UserId id = (UserId)(random() % count);
+            std::wstring expected = Username(id);
+            // Every published user is complete: its name, its index entry and its flags
+            if (database.GetUsername(id) != expected || database.Find(expected) != id) {
+                ++errors;
+            }
+
+            // Writer only blocks even ids, an odd one blocked means a flag landed on the wrong user
+            if (id % 2 != 0 && database.IsBlocked(id)) {
+                ++errors;
+            }
+
+            if (database.Find(L"missing" + std::to_wstring(id)) != kInvalidUser) {
+                ++errors;
+            }
+        } while (isWriting.load(std::memory_order_acquire));
+
+        return errors;
+    }
+
+    // Returns number of positions out of order. Every user has to be listed once
+    size_t CheckOrder(const Database& database) {
+        std::vector<UserId> ids(database.UserCount());
+        size_t errors = ids.size() - database.GetUsersInOrder(0, ids.size(), ids.data());
+        std::vector<bool> seen(ids.size());
+        for (size_t position = 0; position < ids.size(); ++position) {
+            if (ids[position] >= ids.size() || seen[ids[position]]) {
+                ++errors;
+                continue;
+            }
+
+            seen[ids[position]] = true;
+            if (position > 0 && database.GetUsername(ids[position - 1]) >= database.GetUsername(ids[position])) {
+                ++errors;
+            }
+        }
+
+        // user1, user10 to user19, and so on up to user10000 to user19999
+        size_t first;
+        if (database.FindPrefix(L"user1", first) != 11111 || ids[first] != 1) {
+            ++errors;
+        }
+
+        return errors;
+    }
+}
+
+int main() {
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "pr2_stress";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    std::wstring filename = (directory / "users.dat").wstring();
+    size_t errors = 0;
+    {
+        Database database(filename.c_str(), false);
+        std::atomic<bool> isWriting = true;
+        std::vector<size_t> readerErrors(kReaders, 0);
+        std::vector<std::thread> readers;
+        for (size_t i = 0; i < kReaders; ++i) {
+            readers.emplace_back([&, i]() { readerErrors[i] = Read(database, isWriting, (unsigned)i); });
+        }
+
+        std::mt19937 random(42);
+        for (size_t i = 0; i < kUsers; ++i) {
+            if (database.AddUser(User(Username(i), L"", false, false)) != (UserId)i) {
+                ++errors;
+            }
+
+            if (i % kBlockEvery == 0) {
+                UserId id = (UserId)(random() % (i + 1) & ~1u);
+                database.SetBlocked(id, !database.IsBlocked(id));
+            }
+        }
+
+        isWriting.store(false, std::memory_order_release);
+        for (size_t i = 0; i < kReaders; ++i) {
+            readers[i].join();
+            errors += readerErrors[i];
+        }
+
+        errors += CheckOrder(database);
+        database.Flush();
+    }
+
+    // Journal replays to the same users
+    Database reopened(filename.c_str(), false);
+    if (reopened.UserCount() != kUsers || reopened.Find(Username(kUsers - 1)) != (UserId)(kUsers - 1)) {
+        ++errors;
+    }
+
+    errors += CheckOrder(reopened);
+
+    std::filesystem::remove_all(directory);
+    if (errors != 0) {
+        fprintf(stderr, "%zu inconsistent reads\n", errors);
+        return 1;
+    }
+
+    printf("%zu users, %zu readers: OK\n", kUsers, kReaders);
+    return 0;
+}
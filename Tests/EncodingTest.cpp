@@ -0,0 +1,68 @@
+// Everything WriteUtf8 writes reads back, overlong forms are refused, and names that aren't Unicode never reach a snapshot
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <random>
+
+#include "Database.h"
+#include "Encoding.h"
+
+namespace {
+    int failures = 0;
+
+    void Check(bool condition, const char* what) {
+        if (!condition) {
+            fprintf(stderr, "FAILED: %s\n", what);
+            ++failures;
+        }
+    }
+
+    bool Read(const char* text) {
+        std::wstring string;
+        return ReadUtf8(text, strlen(text), string);
+    }
+}
+
+int main() {
+    Check(Read("\xC2\x80") && Read("\xE0\xA0\x80") && Read("\xF0\x90\x80\x80") && Read("\xF4\x8F\xBF\xBF"), "shortest forms are read");
+    Check(!Read("\xC0\x80") && !Read("\xC1\xBF"), "overlong 2-byte form is refused");
+    Check(!Read("\xE0\x80\x80") && !Read("\xE0\x9F\xBF"), "overlong 3-byte form is refused");
+    Check(!Read("\xF0\x80\x80\x80") && !Read("\xF0\x8F\xBF\xBF"), "overlong 4-byte form is refused");
+    Check(!Read("\xF4\x90\x80\x80") && !Read("\xE0\xA0"), "past U+10FFFF and truncated are refused");
+
+    std::wstring loneSurrogate(1, (wchar_t)0xD800);
+    Check(!IsValidUnicode(loneSurrogate), "lone surrogate isn't Unicode");
+    Check(IsValidUnicode(L"user\u00E9\U0001F600"), "pair or 4-byte character is Unicode");
+    std::wstring read;
+    std::vector<char> buffer;
+    WriteUtf8(buffer, loneSurrogate);
+    Check(buffer.size() == Utf8Length(loneSurrogate) && ReadUtf8(buffer.data(), buffer.size(), read) && read == loneSurrogate, "lone surrogate round-trips");
+    if (sizeof(wchar_t) == 4) {
+        std::wstring tooLarge(1, (wchar_t)0x110000);
+        Check(!IsValidUnicode(tooLarge), "value past U+10FFFF isn't Unicode");
+        buffer.clear();
+        WriteUtf8(buffer, tooLarge);
+        Check(buffer.size() == Utf8Length(tooLarge) && ReadUtf8(buffer.data(), buffer.size(), read) && read == L"\uFFFD", "value past U+10FFFF is written as U+FFFD");
+    }
+
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / ("pr2_encoding_" + std::to_string(std::random_device()()));
+    std::filesystem::create_directories(directory);
+    std::wstring filename = (directory / "users.dat").wstring();
+    {
+        Database database(filename.c_str(), false);
+        Check(database.AddUser(User(loneSurrogate, L"", false, false)) == kInvalidUser, "lone surrogate username is refused");
+        Check(database.AddUsers({ User(loneSurrogate, L"", false, false) })[0] == kInvalidUser, "lone surrogate username is refused in a batch");
+        Check(database.AddUser(User(L"user\u00E9\U0001F600", L"", false, false)) != kInvalidUser, "Unicode username is added");
+        database.Save();
+    }
+
+    Database reopened(filename.c_str(), false);
+    Check(!reopened.isCorrupted && reopened.Find(L"user\u00E9\U0001F600") != kInvalidUser, "snapshot loads back");
+    std::filesystem::remove_all(directory);
+    if (failures != 0) {
+        return 1;
+    }
+
+    printf("encoding: OK\n");
+    return 0;
+}
@@ -0,0 +1,46 @@
+#!/bin/sh
+# Imports a user into a scratch database, serves it and logs in through the socket,
+# then does the same with the database split into shards.
+# Usage: ServerSmokeTest.sh <PR2Server>
+server="$1"
+dir=$(mktemp -d)
+pid=""
+trap '[ -n "$pid" ] && kill "$pid" && wait "$pid"; rm -rf "$dir"' EXIT
+
+# Starts the server with extra options and waits for its socket
+serve() {
+    rm -f "$dir/auth.sock"
+    "$server" --server "$dir/auth.sock" --database users.dat --limits limits.dat --workers 2 "$@" >> server.log 2>&1 &
+    pid=$!
+    for i in $(seq 100); do
+        [ -S auth.sock ] && return 0
+        sleep 0.1
+    done
+
+    return 1
+}
+
+stop() {
+    kill "$pid" && wait "$pid"
+    pid=""
+}
+cd "$dir" || exit 1
+
+printf 'username,password\nalice,Secret7\n' > users.csv
+"$server" --import users.csv --database users.dat || exit 1
+
+serve || exit 1
+
+# Both clients have to get OK for every login
+"$server" --bench "$dir/auth.sock" alice Secret7 --clients 2 --requests 2 | grep -q "requests: 4 ok, 0 failed" || exit 1
+# Wrong password must not log in
+if "$server" --bench "$dir/auth.sock" alice Wrong7 --clients 1 --requests 1; then
+    exit 1
+fi
+
+stop
+"$server" --reshard 4 --database users.dat || exit 1
+serve --shards 4 || exit 1
+"$server" --bench "$dir/auth.sock" alice Secret7 --clients 2 --requests 2 | grep -q "requests: 4 ok, 0 failed" || exit 1
+
+exit 0
@@ -0,0 +1,88 @@
+// Revoking a user ends only that user's sessions, also for ids that share low bits or a generation block.
+// Blocking users in bulk ends their sessions too
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <string>
+
+#include "AuthService.h"
+#include "Database.h"
+#include "SessionService.h"
+
+namespace {
+    int failures = 0;
+
+    void Check(bool condition, const char* what) {
+        if (!condition) {
+            fprintf(stderr, "FAILED: %s\n", what);
+            ++failures;
+        }
+    }
+
+    bool IsValid(SessionService& sessions, const SessionToken& token, UserId expected) {
+        UserId user = kInvalidUser;
+        return sessions.Validate(token, user) && user == expected;
+    }
+}
+
+int main() {
+    SessionService sessions;
+    // Id 0 is the admin of a new database
+    const UserId user = 0;
+    const UserId far = user + (UserId)kSessionGenerationBlock;
+    const UserId neighbour = user + 1;
+    SessionToken userToken = sessions.Issue(user);
+    SessionToken farToken = sessions.Issue(far);
+    SessionToken neighbourToken = sessions.Issue(neighbour);
+
+    sessions.RevokeUser(far);
+    Check(!IsValid(sessions, farToken, far), "revoked user is logged out");
+    Check(IsValid(sessions, userToken, user), "user N survives revocation of N + block size");
+    Check(IsValid(sessions, neighbourToken, neighbour), "neighbour survives revocation");
+
+    sessions.RevokeUser(user);
+    Check(!IsValid(sessions, userToken, user), "user N is logged out by its own revocation");
+    Check(IsValid(sessions, neighbourToken, neighbour), "neighbour in the same block survives");
+
+    // Login after the revocation gets a working session
+    SessionToken fresh = sessions.Issue(user);
+    Check(IsValid(sessions, fresh, user), "new session after revocation");
+
+    // Highest id has a block too
+    SessionToken last = sessions.Issue(kInvalidUser - 1);
+    sessions.RevokeUser(kInvalidUser - 1);
+    Check(!IsValid(sessions, last, kInvalidUser - 1), "highest id is revoked");
+
+    SessionToken forged = { fresh.id, fresh.secret ^ 1 };
+    Check(!IsValid(sessions, forged, user), "forged secret is refused");
+    sessions.Revoke(fresh);
+    Check(!IsValid(sessions, fresh, user), "revoked session is refused");
+
+    // SetBlockedWhere bypasses AuthService, the next check of the session sees the block
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / ("pr2_session_" + std::to_string(std::random_device()()));
+    std::filesystem::create_directories(directory);
+    std::wstring filename = (directory / "users.dat").wstring();
+    {
+        Database database(filename.c_str(), false);
+        AuthService auth(database);
+        UserId blocked = database.AddUser(User(L"blocked", L"", false, false));
+        UserId kept = database.AddUser(User(L"kept", L"", false, false));
+        database.SetPassword(kept, L"password");
+        SessionToken blockedToken = auth.sessions.Issue(blocked);
+        SessionToken keptToken = auth.sessions.Issue(kept);
+        database.SetBlockedWhere(AccountFlag::NO_PASSWORD, true);
+        UserId found = kInvalidUser;
+        Check(auth.CheckSession(blockedToken, found) == AuthStatus::SESSION_EXPIRED, "bulk blocked user is logged out");
+        Check(!IsValid(auth.sessions, blockedToken, blocked), "session of bulk blocked user is revoked");
+        Check(auth.CheckSession(keptToken, found) == AuthStatus::OK && found == kept, "user outside the bulk block keeps the session");
+        database.Flush();
+    }
+
+    std::filesystem::remove_all(directory);
+    if (failures != 0) {
+        return 1;
+    }
+
+    printf("sessions: OK\n");
+    return 0;
+}
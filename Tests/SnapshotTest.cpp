@@ -0,0 +1,58 @@
+// Snapshot that can't be written is reported and retried later, and a damaged image never replaces users
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <vector>
+
+#include "Database.h"
+#include "FileUtils.h"
+
+namespace {
+    int failures = 0;
+
+    void Check(bool condition, const char* what) {
+        if (!condition) {
+            fprintf(stderr, "FAILED: %s\n", what);
+            ++failures;
+        }
+    }
+}
+
+int main() {
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / ("pr2_snapshot_" + std::to_string(std::random_device()()));
+    std::filesystem::create_directories(directory);
+    std::wstring filename = (directory / "users.dat").wstring();
+    std::vector<char> image;
+    {
+        Database database(filename.c_str(), false);
+        UserId first = database.AddUser(User(L"first", L"", false, false));
+        database.AddUser(User(L"second", L"", false, false));
+        Check(database.Save() && database.savesWritten == 1, "snapshot is written");
+        Check(FileReadAll(filename.c_str(), image), "snapshot is read back");
+
+        // Temporary snapshot can't be created over a directory
+        std::filesystem::create_directory(directory / "users.dat.tmp");
+        database.SetBlocked(first, true);
+        Check(!database.Save() && database.savesFailed == 1 && database.IsDirty(first), "failed save is reported and keeps changes");
+        for (size_t i = 0; i < 2 * kJournalCompactThreshold; ++i) {
+            database.SetBlocked(first, i % 2 != 0);
+        }
+
+        Check(database.savesFailed == 3, "journal compaction backs off after a failure");
+        std::filesystem::remove(directory / "users.dat.tmp");
+        Check(database.Save() && database.savesWritten == 2 && database.dirtyUsers == 0, "save succeeds once the file can be written");
+
+        std::vector<char> truncated(image.begin(), image.end() - 1);
+        Check(!database.Load(truncated.data(), truncated.data() + truncated.size()), "truncated image is refused");
+        Check(database.UserCount() == 2 && database.Find(L"second") == first + 1 && database.IsBlocked(first), "refused image keeps users");
+        Check(database.Load(image.data(), image.data() + image.size()) && !database.IsBlocked(first), "whole image replaces users");
+    }
+
+    std::filesystem::remove_all(directory);
+    if (failures != 0) {
+        return 1;
+    }
+
+    printf("snapshot: OK\n");
+    return 0;
+}
@@ -1,16 +1,18 @@
 #include <fstream>
+#include <cstring>
 
 #include "User.h"
+#include "Encoding.h"
 
 User::User()
-    : isBlocked(false), isRestrictionEnabled(false) {}
+    : passwordHash(), isBlocked(false), isRestrictionEnabled(false) {}
 
-User::User(const wchar_t* username, const wchar_t* password, bool isBlocked, bool isRestrictionEnabled)
-    : username(username), password(password), isBlocked(isBlocked), isRestrictionEnabled(isRestrictionEnabled) {
+User::User(std::wstring_view username, std::wstring_view password, bool isBlocked, bool isRestrictionEnabled)
+    : username(username), password(password), passwordHash(), isBlocked(isBlocked), isRestrictionEnabled(isRestrictionEnabled) {
 }
 
 User::User(User&& other) noexcept
-    : username(std::move(other.username)), password(std::move(other.password)), isBlocked(other.isBlocked), isRestrictionEnabled(other.isRestrictionEnabled) {
+    : username(std::move(other.username)), password(std::move(other.password)), passwordHash(other.passwordHash), isBlocked(other.isBlocked), isRestrictionEnabled(other.isRestrictionEnabled) {
     other.isBlocked = false;
     other.isRestrictionEnabled = false;
 }
@@ -35,10 +37,98 @@ std::ifstream& operator>>(std::ifstream& ifs, User& user) {
     ifs.read((char*)&passwordLength, sizeof(passwordLength));
     user.username.resize(usernameLength);
     user.password.resize(passwordLength);
-    user.username[usernameLength] = user.password[passwordLength] = L'\0';
     ifs.read((char*)&user.username[0], sizeof(wchar_t) * usernameLength);
     ifs.read((char*)&user.password[0], sizeof(wchar_t) * passwordLength);
     ifs.read((char*)&user.isBlocked, sizeof(bool));
     ifs.read((char*)&user.isRestrictionEnabled, sizeof(bool));
     return ifs;
 }
+
+void Serialize(std::vector<char>& buffer, const User& user) {
+    if (user.passwordHash.algorithm != KdfAlgorithm::NONE || user.password.empty()) {
+        Serialize(buffer, user.username, user.passwordHash, user.isBlocked, user.isRestrictionEnabled);
+        return;
+    }
+
+    buffer.push_back((char)((user.isBlocked ? kUserBlocked : 0) | (user.isRestrictionEnabled ? kUserRestrictionEnabled : 0)));
+    WriteVarint(buffer, Utf8Length(user.username));
+    WriteUtf8(buffer, user.username);
+    WriteVarint(buffer, Utf8Length(user.password));
+    WriteUtf8(buffer, user.password);
+}
+
+void Serialize(std::vector<char>& buffer, std::wstring_view username, const PasswordHash& passwordHash, bool isBlocked, bool isRestrictionEnabled) {
+    bool isHashed = passwordHash.algorithm != KdfAlgorithm::NONE;
+    buffer.push_back((char)((isBlocked ? kUserBlocked : 0) | (isRestrictionEnabled ? kUserRestrictionEnabled : 0) | (isHashed ? kUserPasswordHashed : 0)));
+    WriteVarint(buffer, Utf8Length(username));
+    WriteUtf8(buffer, username);
+    // Password that isn't set is stored as empty plaintext
+    WriteVarint(buffer, isHashed ? kPasswordHashSize : 0);
+    if (isHashed) {
+        WritePasswordHash(buffer, passwordHash);
+    }
+}
+
+const char* Deserialize(const char* data, const char* end, User& user) {
+    if (data >= end) {
+        return nullptr;
+    }
+
+    uint8_t flags = (uint8_t)*data++;
+    uint64_t length;
+    data = ReadVarint(data, end, length);
+    if (data == nullptr || length > (uint64_t)(end - data) || !ReadUtf8(data, (size_t)length, user.username)) {
+        return nullptr;
+    }
+
+    data += length;
+    data = ReadVarint(data, end, length);
+    if (data == nullptr || length > (uint64_t)(end - data)) {
+        return nullptr;
+    }
+
+    user.passwordHash = PasswordHash();
+    if ((flags & kUserPasswordHashed) != 0) {
+        user.password.clear();
+        if (ReadPasswordHash(data, data + length, user.passwordHash) != data + length) {
+            return nullptr;
+        }
+    }
+    else if (!ReadUtf8(data, (size_t)length, user.password)) {
+        return nullptr;
+    }
+
+    user.isBlocked = (flags & kUserBlocked) != 0;
+    user.isRestrictionEnabled = (flags & kUserRestrictionEnabled) != 0;
+    return data + length;
+}
+
+const char* DeserializeLegacy(const char* data, const char* end, User& user) {
+    size_t usernameLength;
+    size_t passwordLength;
+    if ((size_t)(end - data) < sizeof(usernameLength) + sizeof(passwordLength)) {
+        return nullptr;
+    }
+
+    memcpy(&usernameLength, data, sizeof(usernameLength));
+    data += sizeof(usernameLength);
+    memcpy(&passwordLength, data, sizeof(passwordLength));
+    data += sizeof(passwordLength);
+    // Check each length separately so huge values can't overflow the sum
+    size_t left = (size_t)(end - data);
+    if (usernameLength > left / sizeof(wchar_t) || passwordLength > left / sizeof(wchar_t)
+        || sizeof(wchar_t) * (usernameLength + passwordLength) + 2 * sizeof(bool) > left) {
+        return nullptr;
+    }
+
+    user.username.resize(usernameLength);
+    user.password.resize(passwordLength);
+    memcpy(&user.username[0], data, sizeof(wchar_t) * usernameLength);
+    data += sizeof(wchar_t) * usernameLength;
+    memcpy(&user.password[0], data, sizeof(wchar_t) * passwordLength);
+    data += sizeof(wchar_t) * passwordLength;
+    user.passwordHash = PasswordHash();
+    user.isBlocked = *data++ != 0;
+    user.isRestrictionEnabled = *data++ != 0;
+    return data;
+}
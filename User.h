@@ -1,20 +1,45 @@
 #pragma once
 
 #include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+#include "PasswordHasher.h"
 
 struct User;
 
+// Bits of the flags byte in a v2 record
+constexpr uint8_t kUserBlocked = 1 << 0;
+constexpr uint8_t kUserRestrictionEnabled = 1 << 1;
+// Password field holds a serialized PasswordHash instead of UTF-8 plaintext
+constexpr uint8_t kUserPasswordHashed = 1 << 2;
+
 struct User {
     User();
-    User(const wchar_t* username, const wchar_t* password, bool isBlocked, bool isRestrictionEnabled);
+    User(std::wstring_view username, std::wstring_view password, bool isBlocked, bool isRestrictionEnabled);
     User(const User& other) = default;
     User(User&& other) noexcept;
+    User& operator=(const User& other) = default;
+    User& operator=(User&& other) = default;
 
     friend std::ofstream& operator<<(std::ofstream& ofs, const User& user);
     friend std::ifstream& operator>>(std::ifstream& ifs, User& user);
+    // Appends v2 record: [flags][usernameLength][username][passwordLength][password], lengths are varints, strings are UTF-8.
+    // Writes passwordHash if it is set, plaintext password otherwise
+    friend void Serialize(std::vector<char>& buffer, const User& user);
+    // Parses v2 record from memory. Returns pointer past the record or nullptr if data is truncated or malformed
+    friend const char* Deserialize(const char* data, const char* end, User& user);
+    // Same for the legacy format written by operator<<
+    friend const char* DeserializeLegacy(const char* data, const char* end, User& user);
 
     std::wstring username;
+    // Plaintext from a new user or an old file. Database hashes it on insert
     std::wstring password;
+    PasswordHash passwordHash;
     bool isBlocked;
     bool isRestrictionEnabled;
 };
+
+// Same as Serialize(buffer, user) for users that aren't stored as User
+void Serialize(std::vector<char>& buffer, std::wstring_view username, const PasswordHash& passwordHash, bool isBlocked, bool isRestrictionEnabled);
@@ -1,4 +1,5 @@
 #include "UserPanel.h"
+#include "DialogText.h"
 #include "Constants.h"
 #include "resource.h"
 
@@ -12,48 +13,27 @@ LRESULT CALLBACK ChangePasswordProc(HWND hwnd, UINT message, WPARAM wParam, LPAR
         break;
     case WM_COMMAND:
         if (LOWORD(wParam) == ID_CHANGEPASS_OK && HIWORD(wParam) == BN_CLICKED) {
-            HWND hPassword = GetDlgItem(hwnd, IDC_PASSWORD);
-            HWND hNewPassword = GetDlgItem(hwnd, IDC_NEWPASSWORD);
-            HWND hRepeatNewPassword = GetDlgItem(hwnd, IDC_REPEATNEWPASSWORD);
-            int passwordLength = GetWindowTextLengthW(hPassword);
-            int newPasswordLength = GetWindowTextLengthW(hNewPassword);
-            int repeatNewPasswordLength = GetWindowTextLengthW(hRepeatNewPassword);
-            if (passwordLength == 0 || newPasswordLength == 0 || repeatNewPasswordLength == 0) {
+            alignas(std::max_align_t) char buffer[kDialogArenaSize];
+            std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer));
+            std::pmr::wstring password = GetDialogText(hwnd, IDC_PASSWORD, arena);
+            std::pmr::wstring newPassword = GetDialogText(hwnd, IDC_NEWPASSWORD, arena);
+            std::pmr::wstring repeatNewPassword = GetDialogText(hwnd, IDC_REPEATNEWPASSWORD, arena);
+            if (password.empty() || newPassword.empty() || repeatNewPassword.empty()) {
                 break;
             }
 
-            std::wstring password;
-            std::wstring newPassword;
-            std::wstring repeatNewPassword;
-            password.resize(passwordLength);
-            newPassword.resize(newPasswordLength);
-            repeatNewPassword.resize(repeatNewPasswordLength);
-            GetDlgItemTextW(hwnd, IDC_PASSWORD, &password[0], passwordLength + 1);
-            GetDlgItemTextW(hwnd, IDC_NEWPASSWORD, &newPassword[0], newPasswordLength + 1);
-            GetDlgItemTextW(hwnd, IDC_REPEATNEWPASSWORD, &repeatNewPassword[0], repeatNewPasswordLength + 1);
-
-            User* user = (User*)GetWindowLongPtrW(hwnd, GWLP_USERDATA);
-            if (password != user->password) {
-                MessageBoxW(hwnd, L"Wrong password!", L"Warning", MB_OK | MB_ICONERROR);
-                break;
-            }
-
-            if (password == newPassword) {
-                MessageBoxW(hwnd, L"Passwords shouldn't be the same!", L"Warning", MB_OK | MB_ICONERROR);
-                break;
-            }
-
-            if (user->isRestrictionEnabled && !IsPasswordValid(newPassword)) {
-                MessageBoxW(hwnd, L"Password must contain latin, cyrillic characters and numbers!", L"Warning", MB_OK | MB_ICONERROR);
+            if (newPassword != repeatNewPassword) {
+                MessageBoxW(hwnd, L"Passwords don't match!", L"Warning", MB_OK | MB_ICONERROR);
                 break;
             }
 
-            if (newPassword != repeatNewPassword) {
-                MessageBoxW(hwnd, L"Passwords don't match!", L"Warning", MB_OK | MB_ICONERROR);
+            const UserPanelInput* input = (const UserPanelInput*)GetWindowLongPtrW(hwnd, GWLP_USERDATA);
+            AuthStatus status = input->auth.ChangePassword(input->session, password, newPassword);
+            if (status != AuthStatus::OK) {
+                MessageBoxW(hwnd, input->auth.GetStatusMessage(status), L"Warning", MB_OK | MB_ICONERROR);
                 break;
             }
 
-            user->password = newPassword;
             EndDialog(hwnd, true);
         }
 
@@ -71,7 +51,8 @@ LRESULT CALLBACK UserPanelProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lP
     {
         SetWindowLongPtrW(hwnd, GWLP_USERDATA, lParam);
         HWND hUserName = GetDlgItem(hwnd, IDC_USER_USERNAME);
-        std::wstring text = L"User: " + ((const UserPanelInput*)lParam)->user->username;
+        const UserPanelInput* input = (const UserPanelInput*)lParam;
+        std::wstring text = std::wstring(L"User: ").append(input->database.GetUsername(input->user));
         SetWindowTextW(hUserName, text.c_str());
         break;
     }
@@ -80,16 +61,15 @@ LRESULT CALLBACK UserPanelProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lP
         break;
     case WM_COMMAND:
         if (LOWORD(wParam) == ID_MENU_ABOUTPROGRAM) {
-            MessageBoxW(hwnd, kAboutMessage, L"About Program", MB_ICONINFORMATION | MB_OK);
+            const UserPanelInput* input = (const UserPanelInput*)GetWindowLongPtrW(hwnd, GWLP_USERDATA);
+            std::wstring about = std::wstring(kAboutMessage).append(DescribePasswordPolicy(input->auth.passwordPolicy));
+            MessageBoxW(hwnd, about.c_str(), L"About Program", MB_ICONINFORMATION | MB_OK);
             break;
         }
         else if (LOWORD(wParam) == ID_USER_CHANGEPASS && HIWORD(wParam) == BN_CLICKED) {
-            // Change password. Update database
+            // Change password. Database journals it
             const UserPanelInput* input = (const UserPanelInput*)GetWindowLongPtrW(hwnd, GWLP_USERDATA);
-            bool status = DialogBoxParamW(GetModuleHandleW(nullptr), MAKEINTRESOURCE(IDD_CHANGEPASSWORD), hwnd, ChangePasswordProc, (LPARAM)input->user);
-            if (status) {
-                input->database.Save();
-            }
+            DialogBoxParamW(GetModuleHandleW(nullptr), MAKEINTRESOURCE(IDD_CHANGEPASSWORD), hwnd, ChangePasswordProc, (LPARAM)input);
 
             break;
         }
@@ -2,11 +2,17 @@
 
 #include <Windows.h>
 
+#include "AuthService.h"
 #include "Database.h"
 
 struct UserPanelInput {
+    AuthService& auth;
+    // Store of auth, the admin panel lists and searches it
     Database& database;
-    User* user;
+    // User the panel shows
+    UserId user;
+    // Of the logged in user. Profiles opened by the admin carry the admin's session
+    SessionToken session;
 };
 
 LRESULT CALLBACK ChangePasswordProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam);
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string_view>
+#include <cstdint>
+
+#include "User.h"
+
+// Stable handle of a user. Users are never removed, so handles stay valid for the store lifetime
+using UserId = uint32_t;
+constexpr UserId kInvalidUser = UINT32_MAX;
+
+// Users as AuthService sees them. Database keeps them in one file, ShardedDatabase splits them over several.
+// Implementations are thread-safe and their reads don't block
+struct UserStore {
+    virtual ~UserStore() = default;
+
+    // Returns kInvalidUser if user doesn't exist
+    virtual UserId Find(std::wstring_view username) const = 0;
+    // Returns kInvalidUser if user with such name already exists, the name isn't valid Unicode or the store is full
+    virtual UserId AddUser(const User& user) = 0;
+    // Hashes password with default KDF parameters. Empty password resets it
+    virtual void SetPassword(UserId id, std::wstring_view password) = 0;
+    // Sets password only if user has none, checked and written in one step. Returns false if it's set already
+    virtual bool SetInitialPassword(UserId id, std::wstring_view password) = 0;
+    virtual void SetBlocked(UserId id, bool isBlocked) = 0;
+    virtual void SetRestrictionEnabled(UserId id, bool isRestrictionEnabled) = 0;
+    // Waits until every mutation made before the call is on disk
+    virtual void Flush() = 0;
+
+    virtual std::wstring_view GetUsername(UserId id) const = 0;
+    virtual bool HasPassword(UserId id) const = 0;
+    virtual bool VerifyPassword(UserId id, std::wstring_view password) const = 0;
+    virtual bool IsBlocked(UserId id) const = 0;
+    virtual bool IsRestrictionEnabled(UserId id) const = 0;
+};
@@ -0,0 +1,630 @@
+#include <chrono>
+#include <cstring>
+#include <string_view>
+
+#include "UserTransfer.h"
+#include "Constants.h"
+#include "PasswordPolicy.h"
+#include "Encoding.h"
+#include "FileUtils.h"
+
+namespace {
+    // Bytes read from the file at once
+    constexpr size_t kReadBlockSize = 1 << 20;
+    const char kHexDigits[] = "0123456789abcdef";
+    const char kCsvHeader[] = "username,password_hash,blocked,restricted\n";
+
+    enum CsvColumn {
+        USERNAME,
+        PASSWORD,
+        PASSWORD_HASH,
+        BLOCKED,
+        RESTRICTED,
+        COLUMN_COUNT
+    };
+
+    const char* const kCsvColumns[COLUMN_COUNT] = { "username", "password", "password_hash", "blocked", "restricted" };
+
+    struct Record {
+        User user;
+        size_t line = 0;
+    };
+
+    void WriteHex(std::vector<char>& buffer, const char* data, size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            buffer.push_back(kHexDigits[(uint8_t)data[i] >> 4]);
+            buffer.push_back(kHexDigits[(uint8_t)data[i] & 15]);
+        }
+    }
+
+    bool ParseHash(std::string_view text, PasswordHash& hash) {
+        if (text.size() != kPasswordHashSize * 2) {
+            return false;
+        }
+
+        char bytes[kPasswordHashSize];
+        for (size_t i = 0; i < kPasswordHashSize; ++i) {
+            int high = HexDigit(text[i * 2]);
+            int low = HexDigit(text[i * 2 + 1]);
+            if (high < 0 || low < 0) {
+                return false;
+            }
+
+            bytes[i] = (char)((high << 4) | low);
+        }
+
+        return ReadPasswordHash(bytes, bytes + kPasswordHashSize, hash) != nullptr;
+    }
+
+    bool ParseBool(std::string_view text, bool& value) {
+        if (text.empty() || text == "0" || text == "false") {
+            value = false;
+            return true;
+        }
+
+        if (text == "1" || text == "true") {
+            value = true;
+            return true;
+        }
+
+        return false;
+    }
+
+    // Splits line into fields. Quoted fields may contain commas and "" for a quote
+    bool SplitCsv(std::string_view line, std::vector<std::string>& fields) {
+        fields.clear();
+        size_t i = 0;
+        while (true) {
+            std::string& field = fields.emplace_back();
+            if (i < line.size() && line[i] == '"') {
+                ++i;
+                while (true) {
+                    if (i >= line.size()) {
+                        return false;
+                    }
+
+                    if (line[i] == '"') {
+                        if (i + 1 < line.size() && line[i + 1] == '"') {
+                            field += '"';
+                            i += 2;
+                            continue;
+                        }
+
+                        ++i;
+                        break;
+                    }
+
+                    field += line[i++];
+                }
+
+                if (i < line.size() && line[i] != ',') {
+                    return false;
+                }
+            }
+            else {
+                size_t end = line.find(',', i);
+                end = end == std::string_view::npos ? line.size() : end;
+                field.assign(line.substr(i, end - i));
+                i = end;
+            }
+
+            if (i >= line.size()) {
+                return true;
+            }
+
+            ++i;
+        }
+    }
+
+    void SkipSpaces(std::string_view line, size_t& i) {
+        while (i < line.size() && (line[i] == ' ' || line[i] == '\t')) {
+            ++i;
+        }
+    }
+
+    bool ParseJsonString(std::string_view line, size_t& i, std::string& text) {
+        text.clear();
+        if (i >= line.size() || line[i] != '"') {
+            return false;
+        }
+
+        ++i;
+        while (i < line.size()) {
+            char ch = line[i++];
+            if (ch == '"') {
+                return true;
+            }
+
+            if (ch != '\\') {
+                text += ch;
+                continue;
+            }
+
+            if (i >= line.size()) {
+                return false;
+            }
+
+            char escape = line[i++];
+            const char* simple = strchr("\"\\/bfnrt", escape);
+            if (simple != nullptr && escape != '\0') {
+                text += "\"\\/\b\f\n\r\t"[simple - "\"\\/bfnrt"];
+                continue;
+            }
+
+            if (escape != 'u') {
+                return false;
+            }
+
+            uint32_t codePoint = 0;
+            for (int pair = 0; pair < 2; ++pair) {
+                if (i + 4 > line.size()) {
+                    return false;
+                }
+
+                uint32_t unit = 0;
+                for (int digit = 0; digit < 4; ++digit) {
+                    int value = HexDigit(line[i++]);
+                    if (value < 0) {
+                        return false;
+                    }
+
+                    unit = (unit << 4) | (uint32_t)value;
+                }
+
+                if (pair == 1) {
+                    if (unit < 0xDC00 || unit > 0xDFFF) {
+                        return false;
+                    }
+
+                    codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (unit - 0xDC00);
+                    break;
+                }
+
+                codePoint = unit;
+                // High surrogate is followed by \u of the low one
+                if (unit < 0xD800 || unit > 0xDBFF) {
+                    break;
+                }
+
+                if (i + 2 > line.size() || line[i] != '\\' || line[i + 1] != 'u') {
+                    return false;
+                }
+
+                i += 2;
+            }
+
+            if (codePoint >= 0xDC00 && codePoint <= 0xDFFF) {
+                return false;
+            }
+
+            WriteCodePoint(text, codePoint);
+        }
+
+        return false;
+    }
+
+    bool ToWide(const std::string& text, std::wstring& string) {
+        return ReadUtf8(text.data(), text.size(), string);
+    }
+
+    // Returns error or nullptr
+    const char* ParseJsonRecord(std::string_view line, User& user) {
+        std::string key;
+        std::string value;
+        size_t i = 0;
+        SkipSpaces(line, i);
+        if (i >= line.size() || line[i++] != '{') {
+            return "expected an object";
+        }
+
+        SkipSpaces(line, i);
+        if (i < line.size() && line[i] == '}') {
+            return "missing username";
+        }
+
+        while (true) {
+            SkipSpaces(line, i);
+            if (!ParseJsonString(line, i, key)) {
+                return "malformed key";
+            }
+
+            SkipSpaces(line, i);
+            if (i >= line.size() || line[i++] != ':') {
+                return "expected ':'";
+            }
+
+            SkipSpaces(line, i);
+            bool isString = i < line.size() && line[i] == '"';
+            bool flag = false;
+            if (isString) {
+                if (!ParseJsonString(line, i, value)) {
+                    return "malformed string";
+                }
+            }
+            else if (line.substr(i, 4) == "true" || line.substr(i, 4) == "null") {
+                flag = line[i] == 't';
+                i += 4;
+            }
+            else if (line.substr(i, 5) == "false") {
+                i += 5;
+            }
+            else {
+                return "unsupported value";
+            }
+
+            if (key == "username" || key == "password" || key == "passwordHash") {
+                if (!isString) {
+                    return "expected a string";
+                }
+
+                if (key == "passwordHash") {
+                    if (!ParseHash(value, user.passwordHash)) {
+                        return "malformed password hash";
+                    }
+                }
+                else if (!ToWide(value, key == "username" ? user.username : user.password)) {
+                    return "invalid UTF-8";
+                }
+            }
+            else if (key == "blocked" || key == "restricted") {
+                if (isString) {
+                    return "expected a boolean";
+                }
+
+                (key == "blocked" ? user.isBlocked : user.isRestrictionEnabled) = flag;
+            }
+
+            SkipSpaces(line, i);
+            if (i < line.size() && line[i] == ',') {
+                ++i;
+                continue;
+            }
+
+            if (i < line.size() && line[i] == '}') {
+                ++i;
+                break;
+            }
+
+            return "expected ',' or '}'";
+        }
+
+        SkipSpaces(line, i);
+        return i == line.size() ? nullptr : "trailing characters";
+    }
+
+    const char* ParseCsvRecord(const std::vector<std::string>& fields, const int (&columns)[COLUMN_COUNT], User& user) {
+        for (int column = 0; column < COLUMN_COUNT; ++column) {
+            if (columns[column] < 0) {
+                continue;
+            }
+
+            if ((size_t)columns[column] >= fields.size()) {
+                return "missing fields";
+            }
+
+            const std::string& field = fields[columns[column]];
+            switch (column) {
+            case USERNAME:
+                if (!ToWide(field, user.username)) {
+                    return "invalid UTF-8";
+                }
+                break;
+            case PASSWORD:
+                if (!ToWide(field, user.password)) {
+                    return "invalid UTF-8";
+                }
+                break;
+            case PASSWORD_HASH:
+                if (!field.empty() && !ParseHash(field, user.passwordHash)) {
+                    return "malformed password hash";
+                }
+                break;
+            case BLOCKED:
+                if (!ParseBool(field, user.isBlocked)) {
+                    return "expected a boolean";
+                }
+                break;
+            case RESTRICTED:
+                if (!ParseBool(field, user.isRestrictionEnabled)) {
+                    return "expected a boolean";
+                }
+                break;
+            }
+        }
+
+        return nullptr;
+    }
+
+    bool HasControlCharacters(std::wstring_view text) {
+        for (wchar_t ch : text) {
+            if (ch < 0x20 || ch == 0x7F) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void Reject(ImportReport& report, size_t line, const char* reason) {
+        ++report.invalid;
+        if (report.errors.size() < kMaxImportErrors) {
+            report.errors.push_back("line " + std::to_string(line) + ": " + reason);
+        }
+    }
+
+    // Checks password policy for the whole batch, then adds it as one database version
+    void CommitBatch(Database& database, std::vector<Record>& batch, const PasswordPolicy& passwordPolicy, ImportReport& report) {
+        std::vector<User> users;
+        std::vector<size_t> lines;
+        users.reserve(batch.size());
+        lines.reserve(batch.size());
+        for (size_t i = 0; i < batch.size(); ++i) {
+            User& user = batch[i].user;
+            bool isHashed = user.passwordHash.algorithm != KdfAlgorithm::NONE;
+            if (!isHashed && user.isRestrictionEnabled && !user.password.empty() && !passwordPolicy.IsValid(user.password)) {
+                Reject(report, batch[i].line, "password doesn't match the restriction");
+                continue;
+            }
+
+            // Hash wins over plaintext
+            if (isHashed) {
+                user.password.clear();
+            }
+
+            users.push_back(std::move(user));
+            lines.push_back(batch[i].line);
+        }
+
+        std::vector<UserId> ids = database.AddUsers(users);
+        for (size_t i = 0; i < ids.size(); ++i) {
+            if (ids[i] == kInvalidUser) {
+                ++report.duplicates;
+                if (report.errors.size() < kMaxImportErrors) {
+                    report.errors.push_back("line " + std::to_string(lines[i]) + ": user already exists");
+                }
+            }
+            else {
+                ++report.imported;
+            }
+        }
+
+        batch.clear();
+    }
+
+    void WriteCsvField(std::vector<char>& buffer, std::wstring_view text) {
+        size_t start = buffer.size();
+        WriteUtf8(buffer, text);
+        bool isQuoted = false;
+        for (size_t i = start; i < buffer.size() && !isQuoted; ++i) {
+            isQuoted = buffer[i] == ',' || buffer[i] == '"' || buffer[i] == '\n' || buffer[i] == '\r';
+        }
+
+        if (!isQuoted) {
+            return;
+        }
+
+        std::string field(buffer.begin() + start, buffer.end());
+        buffer.resize(start);
+        buffer.push_back('"');
+        for (char ch : field) {
+            if (ch == '"') {
+                buffer.push_back('"');
+            }
+
+            buffer.push_back(ch);
+        }
+
+        buffer.push_back('"');
+    }
+
+    void WriteJsonString(std::vector<char>& buffer, std::wstring_view text) {
+        size_t start = buffer.size();
+        WriteUtf8(buffer, text);
+        std::string raw(buffer.begin() + start, buffer.end());
+        buffer.resize(start);
+        buffer.push_back('"');
+        for (char ch : raw) {
+            if (ch == '"' || ch == '\\') {
+                buffer.push_back('\\');
+                buffer.push_back(ch);
+            }
+            else if ((uint8_t)ch < 0x20) {
+                const char escape[] = { '\\', 'u', '0', '0', kHexDigits[ch >> 4], kHexDigits[ch & 15] };
+                buffer.insert(buffer.end(), escape, escape + sizeof(escape));
+            }
+            else {
+                buffer.push_back(ch);
+            }
+        }
+
+        buffer.push_back('"');
+    }
+
+    void Append(std::vector<char>& buffer, const char* text) {
+        buffer.insert(buffer.end(), text, text + strlen(text));
+    }
+
+    void WriteHashText(std::vector<char>& buffer, const PasswordHash& hash) {
+        if (hash.algorithm == KdfAlgorithm::NONE) {
+            return;
+        }
+
+        std::vector<char> serialized;
+        WritePasswordHash(serialized, hash);
+        WriteHex(buffer, serialized.data(), serialized.size());
+    }
+}
+
+TransferFormat GetTransferFormat(const wchar_t* filename) {
+    std::wstring_view name = filename;
+    size_t dot = name.rfind(L'.');
+    std::wstring_view extension = dot == std::wstring_view::npos ? std::wstring_view() : name.substr(dot);
+    return extension == L".jsonl" || extension == L".json" ? TransferFormat::JSONL : TransferFormat::CSV;
+}
+
+ImportReport ImportUsers(Database& database, const wchar_t* filename, const PasswordPolicy& passwordPolicy) {
+    return ImportUsers(database, filename, GetTransferFormat(filename), passwordPolicy);
+}
+
+ImportReport ImportUsers(Database& database, const wchar_t* filename, TransferFormat format, const PasswordPolicy& passwordPolicy) {
+    ImportReport report;
+    FILE* file = FileOpen(filename, L"rb");
+    if (file == nullptr) {
+        return report;
+    }
+
+    report.isOpened = true;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Record> batch;
+    batch.reserve(kImportBatchSize);
+    std::vector<std::string> fields;
+    int columns[COLUMN_COUNT] = { -1, -1, -1, -1, -1 };
+    bool hasHeader = format != TransferFormat::CSV;
+    size_t lineNumber = 0;
+    std::string pending;
+    std::vector<char> block(kReadBlockSize);
+    bool isEnd = false;
+    while (!isEnd) {
+        size_t read = fread(block.data(), 1, block.size(), file);
+        isEnd = read == 0;
+        pending.append(block.data(), read);
+        size_t lineStart = 0;
+        while (true) {
+            size_t lineEnd = pending.find('\n', lineStart);
+            // Last line may have no newline
+            if (lineEnd == std::string::npos && !(isEnd && lineStart < pending.size())) {
+                break;
+            }
+
+            lineEnd = lineEnd == std::string::npos ? pending.size() : lineEnd;
+            std::string_view line(pending.data() + lineStart, lineEnd - lineStart);
+            lineStart = lineEnd + 1;
+            ++lineNumber;
+            if (!line.empty() && line.back() == '\r') {
+                line.remove_suffix(1);
+            }
+
+            // UTF-8 BOM
+            if (lineNumber == 1 && line.substr(0, 3) == "\xEF\xBB\xBF") {
+                line.remove_prefix(3);
+            }
+
+            if (line.find_first_not_of(" \t") == std::string_view::npos) {
+                continue;
+            }
+
+            if (!hasHeader) {
+                hasHeader = true;
+                SplitCsv(line, fields);
+                for (size_t i = 0; i < fields.size(); ++i) {
+                    for (int column = 0; column < COLUMN_COUNT; ++column) {
+                        if (fields[i] == kCsvColumns[column]) {
+                            columns[column] = (int)i;
+                        }
+                    }
+                }
+
+                if (columns[USERNAME] < 0) {
+                    Reject(report, lineNumber, "header has no username column");
+                    fclose(file);
+                    return report;
+                }
+
+                continue;
+            }
+
+            Record& record = batch.emplace_back();
+            record.line = lineNumber;
+            const char* error = nullptr;
+            if (format == TransferFormat::JSONL) {
+                error = ParseJsonRecord(line, record.user);
+            }
+            else {
+                error = SplitCsv(line, fields) ? ParseCsvRecord(fields, columns, record.user) : "unterminated quote";
+            }
+
+            if (error == nullptr && record.user.username.empty()) {
+                error = "empty username";
+            }
+
+            // Keeps exported CSV one record per line
+            if (error == nullptr && HasControlCharacters(record.user.username)) {
+                error = "control characters in username";
+            }
+
+            if (error != nullptr) {
+                Reject(report, lineNumber, error);
+                batch.pop_back();
+            }
+            else if (batch.size() == kImportBatchSize) {
+                CommitBatch(database, batch, passwordPolicy, report);
+            }
+        }
+
+        pending.erase(0, std::min(lineStart, pending.size()));
+    }
+
+    fclose(file);
+    if (!batch.empty()) {
+        CommitBatch(database, batch, passwordPolicy, report);
+    }
+
+    // Batches are already journaled, a snapshot on top would write every user twice
+    database.Flush();
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return report;
+}
+
+bool ExportUsers(const Database& database, const wchar_t* filename, size_t& exported) {
+    return ExportUsers(database, filename, GetTransferFormat(filename), exported);
+}
+
+bool ExportUsers(const Database& database, const wchar_t* filename, TransferFormat format, size_t& exported) {
+    exported = 0;
+    FILE* file = FileOpen(filename, L"wb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    std::vector<char> buffer;
+    if (format == TransferFormat::CSV) {
+        Append(buffer, kCsvHeader);
+    }
+
+    bool isOk = true;
+    size_t count = database.UserCount();
+    for (UserId id = 0; id < count && isOk; ++id) {
+        bool isBlocked = database.IsBlocked(id);
+        bool isRestrictionEnabled = database.IsRestrictionEnabled(id);
+        if (format == TransferFormat::CSV) {
+            WriteCsvField(buffer, database.GetUsername(id));
+            buffer.push_back(',');
+            WriteHashText(buffer, database.GetPasswordHash(id));
+            Append(buffer, isBlocked ? ",1" : ",0");
+            Append(buffer, isRestrictionEnabled ? ",1\n" : ",0\n");
+        }
+        else {
+            Append(buffer, "{\"username\":");
+            WriteJsonString(buffer, database.GetUsername(id));
+            PasswordHash hash = database.GetPasswordHash(id);
+            if (hash.algorithm != KdfAlgorithm::NONE) {
+                Append(buffer, ",\"passwordHash\":\"");
+                WriteHashText(buffer, hash);
+                buffer.push_back('"');
+            }
+
+            Append(buffer, isBlocked ? ",\"blocked\":true" : ",\"blocked\":false");
+            Append(buffer, isRestrictionEnabled ? ",\"restricted\":true}\n" : ",\"restricted\":false}\n");
+        }
+
+        ++exported;
+        if (exported % kImportBatchSize == 0) {
+            isOk = FileWrite(file, buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    }
+
+    isOk = isOk && FileWrite(file, buffer.data(), buffer.size()) && FileSync(file);
+    fclose(file);
+    return isOk;
+}
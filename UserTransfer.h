@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Database.h"
+#include "PasswordPolicy.h"
+
+// CSV has a header line with any of: username,password,password_hash,blocked,restricted.
+// JSON Lines has one object per line with keys username, password, passwordHash, blocked, restricted.
+// Records don't span lines. Hash is hex of a serialized PasswordHash and wins over the plaintext password
+enum class TransferFormat {
+    CSV,
+    JSONL
+};
+
+// Users parsed and committed at once
+constexpr size_t kImportBatchSize = 4096;
+// Rejected records listed in ImportReport::errors
+constexpr size_t kMaxImportErrors = 100;
+
+struct ImportReport {
+    bool isOpened = false;
+    size_t imported = 0;
+    size_t duplicates = 0;
+    size_t invalid = 0;
+    // "line N: reason", first kMaxImportErrors only
+    std::vector<std::string> errors;
+    double seconds = 0;
+};
+
+// .jsonl and .json are JSONL, anything else is CSV
+TransferFormat GetTransferFormat(const wchar_t* filename);
+// Streams the file into database in batches, journaled like AddUsers, and returns once they are on disk.
+// Passwords of restricted users must pass passwordPolicy. Existing usernames are skipped
+ImportReport ImportUsers(Database& database, const wchar_t* filename, const PasswordPolicy& passwordPolicy = kDefaultPasswordPolicy);
+ImportReport ImportUsers(Database& database, const wchar_t* filename, TransferFormat format, const PasswordPolicy& passwordPolicy = kDefaultPasswordPolicy);
+// Writes every user with the password hash. Returns false if the file can't be written
+bool ExportUsers(const Database& database, const wchar_t* filename, size_t& exported);
+bool ExportUsers(const Database& database, const wchar_t* filename, TransferFormat format, size_t& exported);
@@ -26,6 +26,7 @@
 #define IDC_LIST_USERS                  1013
 #define IDC_CHECK_BLOCKED               1015
 #define IDC_CHECK_RESTRICTION           1016
+#define IDC_EDIT_SEARCH                 1017
 #define ID_MENU_ABOUTPROGRAM            40002
 
 // Next default values for new objects
@@ -34,7 +35,7 @@
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NEXT_RESOURCE_VALUE        116
 #define _APS_NEXT_COMMAND_VALUE         40003
-#define _APS_NEXT_CONTROL_VALUE         1017
+#define _APS_NEXT_CONTROL_VALUE         1018
 #define _APS_NEXT_SYMED_VALUE           101
 #endif
 #endif